@@ -0,0 +1,409 @@
+/*
+ * cache.c - Thread-safe LRU cache of Web objects keyed by request URI
+ *
+ * 캐시는 URI 해시로 고르는 NSHARDS개의 shard로 나뉜다. shard마다
+ * 해시 테이블(탐색), LRU 이중 연결 리스트(교체 순서), 크기 합계, 락이 따로 있어서
+ * 서로 다른 shard에 대한 히트는 같은 락을 건드리지 않는다.
+ *  - shard 안의 읽기/쓰기는 교재의 readers-writers 방식(readcnt + mutex + w 세마포어)으로
+ *    보호해서 캐시 히트를 처리하는 여러 reader가 동시에 진행된다.
+ *  - 히트 때 LRU 리스트 맨 앞으로 옮기는 작업만 shard의 짧은 lru_mutex로 직렬화한다.
+ *  - 객체는 참조 카운트로 관리한다. reader는 객체를 pin한 채 락 없이 클라이언트에 쓰고,
+ *    그 사이에 교체(evict)된 객체는 마지막 reader가 cache_release할 때 해제된다.
+ * 객체 하나는 MAX_OBJECT_SIZE 바이트 이하로 제한된다. 전체 합계 MAX_CACHE_SIZE는
+ * 모든 shard가 공유하는 cache_size를 CAS로 예약해서 지키고, 공간이 모자라면
+ * LRU 꼬리가 가장 오래된 shard에서 하나씩 교체한다 (근사 전역 LRU).
+ *
+ * 같은 URI에 대한 미스가 동시에 여러 개 오면 첫 번째(leader)만 원 서버에서 가져오고,
+ * 나머지(follower)는 in-flight 테이블의 세마포어에서 leader가 끝나기를 기다렸다가
+ * 캐시에서 응답한다 (collapsed forwarding). CACHE_WAIT_MS가 지나거나 leader의 응답을
+ * 캐시할 수 없었으면 follower는 직접 가져온다.
+ */
+#include <limits.h>
+#include "cache.h"
+#include "proxy.h"
+
+#define NSHARDS  16    /* Independently locked shards (power of 2) */
+#define NBUCKETS 256   /* Hash buckets per shard (power of 2) */
+
+typedef struct {
+    cache_obj_t *buckets[NBUCKETS];
+    cache_obj_t *lru_head, *lru_tail;  /* Most / least recently used */
+    unsigned long tail_stamp;          /* lru_tail->stamp, or ULONG_MAX if empty */
+    size_t size;                       /* Sum of object sizes in this shard */
+    int readcnt;                       /* Number of readers inside */
+    sem_t mutex;                       /* Protects readcnt */
+    sem_t w;                           /* Held by the writer or the first reader */
+    sem_t lru_mutex;                   /* Protects the LRU list and tail_stamp */
+} shard_t;
+
+static shard_t shards[NSHARDS];
+static size_t cache_size;              /* Bytes reserved across all shards */
+
+/* A miss being fetched by a leader; followers wait on sem */
+typedef struct inflight {
+    char *uri;
+    int refcnt;                        /* Table's reference + waiting followers */
+    int waiters;                       /* Followers to wake when the fetch is done */
+    sem_t sem;
+    struct inflight *next;
+} inflight_t;
+
+static inflight_t *inflight[NBUCKETS];
+static sem_t inflight_mutex;           /* Protects inflight and its entries */
+static unsigned long ncollapsed;       /* Followers served by a leader's fetch */
+static unsigned long ntimeouts;        /* Followers that gave up waiting */
+
+static unsigned hash(const char *s);
+static unsigned long now_ms(void);
+static int reserve(size_t size);
+static int evict_one(void);
+static void lru_unlink(shard_t *sp, cache_obj_t *obj);
+static void lru_push(shard_t *sp, cache_obj_t *obj);
+static void wait_leader(inflight_t *e);
+static void inflight_release(inflight_t *e);
+
+void cache_init(void)
+{
+    int i;
+
+    for (i = 0; i < NSHARDS; i++) {
+        shards[i].readcnt = 0;
+        shards[i].tail_stamp = ULONG_MAX;
+        Sem_init(&shards[i].mutex, 0, 1);
+        Sem_init(&shards[i].w, 0, 1);
+        Sem_init(&shards[i].lru_mutex, 0, 1);
+    }
+    Sem_init(&inflight_mutex, 0, 1);
+}
+
+//cache_find - uri에 해당하는 객체를 찾아 참조 카운트를 올려 반환, 없으면 NULL
+//반환된 객체는 다 쓴 뒤 반드시 cache_release 해야 한다.
+cache_obj_t *cache_find(const char *uri)
+{
+    unsigned h = hash(uri);
+    shard_t *sp = &shards[h % NSHARDS];
+    cache_obj_t *obj;
+
+    /* Reader entry */
+    P(&sp->mutex);
+    if (++sp->readcnt == 1)
+        P(&sp->w);
+    V(&sp->mutex);
+
+    for (obj = sp->buckets[(h / NSHARDS) % NBUCKETS]; obj; obj = obj->hnext)
+        if (!strcmp(obj->uri, uri))
+            break;
+    if (obj) {
+        __sync_fetch_and_add(&obj->refcnt, 1);
+        P(&sp->lru_mutex);        /* Mark as most recently used */
+        obj->stamp = now_ms();
+        lru_unlink(sp, obj);
+        lru_push(sp, obj);
+        V(&sp->lru_mutex);
+    }
+
+    /* Reader exit */
+    P(&sp->mutex);
+    if (--sp->readcnt == 0)
+        V(&sp->w);
+    V(&sp->mutex);
+    return obj;
+}
+
+//cache_release - cache_find로 얻은 참조를 반납. 이미 교체된 객체면 마지막 참조가 해제한다.
+void cache_release(cache_obj_t *obj)
+{
+    if (__sync_sub_and_fetch(&obj->refcnt, 1) == 0) {
+        Free(obj->uri);
+        Free(obj->data);
+        Free(obj);
+    }
+}
+
+//cache_insert - 응답을 복사해 캐시에 넣는다. 전체 공간이 모자라면 LRU 순서로 교체
+//hdr_len은 응답 헤더 끝의 빈 줄 위치 - 캐시 히트 때 그 자리에 Connection 헤더를 끼워 보낸다.
+//0이면 data에 이미 완전한 헤더가 들어 있어 그대로 보낸다.
+void cache_insert(const char *uri, const char *data, size_t size, size_t hdr_len)
+{
+    char *copy;
+
+    if (size > MAX_OBJECT_SIZE)
+        return;
+    copy = Malloc(size);
+    memcpy(copy, data, size);
+    cache_insert_owned(uri, copy, size, hdr_len);
+}
+
+//cache_insert_owned - Malloc으로 할당한 data를 복사 없이 그대로 캐시에 넣는다.
+//data는 캐시 소유가 되며, 넣지 못한 경우에도 여기서 해제된다.
+void cache_insert_owned(const char *uri, char *data, size_t size, size_t hdr_len)
+{
+    unsigned h = hash(uri);
+    shard_t *sp = &shards[h % NSHARDS];
+    cache_obj_t *obj, *p, **bucket;
+
+    if (size > MAX_OBJECT_SIZE) {
+        Free(data);
+        return;
+    }
+
+    //락을 하나도 잡지 않은 상태에서 공간을 예약 -> 두 shard 락을 동시에 잡는 일이 없다
+    while (!reserve(size))
+        if (!evict_one()) {
+            Free(data);
+            return;     /* The rest is reserved by inserts in progress */
+        }
+
+    obj = Malloc(sizeof(cache_obj_t));
+    obj->uri = Malloc(strlen(uri) + 1);
+    strcpy(obj->uri, uri);
+    obj->data = data;
+    obj->size = size;
+    obj->hdr_len = hdr_len;
+    obj->refcnt = 1;            /* The cache's own reference */
+    obj->stamp = now_ms();
+
+    bucket = &sp->buckets[(h / NSHARDS) % NBUCKETS];
+    P(&sp->w);
+    for (p = *bucket; p; p = p->hnext)
+        if (!strcmp(p->uri, uri))
+            break;
+    if (p) {                    /* Another thread got here first */
+        V(&sp->w);
+        __sync_fetch_and_sub(&cache_size, size);
+        cache_release(obj);
+        return;
+    }
+    obj->hnext = *bucket;
+    *bucket = obj;
+    P(&sp->lru_mutex);
+    lru_push(sp, obj);
+    V(&sp->lru_mutex);
+    sp->size += size;
+    V(&sp->w);
+}
+
+/*
+ * cache_find_or_lead - Like cache_find, but coalesce concurrent misses.
+ *     On a miss with no fetch in flight, registers one and sets *leader;
+ *     the caller fetches the object and must then call cache_fetch_done.
+ *     If another thread is already fetching uri, waits up to CACHE_WAIT_MS
+ *     for it and looks again; returns NULL with *leader == 0 if the
+ *     object still isn't cached, and the caller fetches it on its own.
+ */
+cache_obj_t *cache_find_or_lead(const char *uri, int *leader)
+{
+    inflight_t *e, **bucket = &inflight[hash(uri) % NBUCKETS];
+    cache_obj_t *obj;
+
+    *leader = 0;
+    if ((obj = cache_find(uri)))
+        return obj;
+
+    P(&inflight_mutex);
+    for (e = *bucket; e; e = e->next)
+        if (!strcmp(e->uri, uri))
+            break;
+    if (!e) {
+        //미스와 테이블 확인 사이에 다른 leader가 끝냈을 수 있다 -> 한 번 더 확인
+        if ((obj = cache_find(uri))) {
+            V(&inflight_mutex);
+            return obj;
+        }
+        e = Malloc(sizeof(inflight_t));
+        e->uri = Malloc(strlen(uri) + 1);
+        strcpy(e->uri, uri);
+        e->refcnt = 1;
+        e->waiters = 0;
+        Sem_init(&e->sem, 0, 0);
+        e->next = *bucket;
+        *bucket = e;
+        V(&inflight_mutex);
+        *leader = 1;
+        return NULL;
+    }
+    e->refcnt++;
+    e->waiters++;
+    V(&inflight_mutex);
+
+    wait_leader(e);
+    if ((obj = cache_find(uri)))
+        __sync_fetch_and_add(&ncollapsed, 1);
+    return obj;
+}
+
+//cache_fetch_done - leader가 (성공이든 실패든) 가져오기를 끝냈다. 기다리는 follower를 모두 깨운다.
+void cache_fetch_done(const char *uri)
+{
+    inflight_t *e, **pp = &inflight[hash(uri) % NBUCKETS];
+
+    P(&inflight_mutex);
+    for (; (e = *pp); pp = &e->next)
+        if (!strcmp(e->uri, uri))
+            break;
+    if (!e) {
+        V(&inflight_mutex);
+        return;
+    }
+    *pp = e->next;
+    for (; e->waiters > 0; e->waiters--)
+        V(&e->sem);
+    V(&inflight_mutex);
+    inflight_release(e);
+}
+
+//cache_print_stats - collapsed forwarding 카운터 출력 (시그널 핸들러에서 호출 가능)
+void cache_print_stats(void)
+{
+    sio_puts("cache: collapsed ");
+    sio_putl(ncollapsed);
+    sio_puts(" wait_timeouts ");
+    sio_putl(ntimeouts);
+    sio_puts("\n");
+}
+
+/* wait_leader - Block until the leader is done or CACHE_WAIT_MS passes */
+static void wait_leader(inflight_t *e)
+{
+    struct timespec deadline;
+    int rc;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += CACHE_WAIT_MS / 1000;
+    deadline.tv_nsec += (CACHE_WAIT_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while ((rc = sem_timedwait(&e->sem, &deadline)) < 0 && errno == EINTR)
+        ;
+
+    P(&inflight_mutex);
+    if (rc < 0) {               /* Timed out: don't expect a wakeup any more */
+        if (e->waiters > 0)
+            e->waiters--;
+        __sync_fetch_and_add(&ntimeouts, 1);
+    }
+    V(&inflight_mutex);
+    inflight_release(e);
+}
+
+/* inflight_release - Drop a reference; the last one frees the entry */
+static void inflight_release(inflight_t *e)
+{
+    int last;
+
+    P(&inflight_mutex);
+    last = (--e->refcnt == 0);
+    V(&inflight_mutex);
+    if (last) {
+        sem_destroy(&e->sem);
+        Free(e->uri);
+        Free(e);
+    }
+}
+
+/* reserve - Atomically claim size bytes of the global budget */
+static int reserve(size_t size)
+{
+    size_t cur = cache_size;
+
+    while (cur + size <= MAX_CACHE_SIZE) {
+        if (__sync_bool_compare_and_swap(&cache_size, cur, cur + size))
+            return 1;
+        cur = cache_size;
+    }
+    return 0;
+}
+
+/*
+ * evict_one - Drop the LRU tail of the shard whose tail is oldest.
+ *     Returns 0 if every shard is empty.
+ */
+static int evict_one(void)
+{
+    shard_t *sp, *victim = NULL;
+    cache_obj_t *obj, **pp;
+    unsigned long oldest = ULONG_MAX;
+    int i;
+
+    //tail_stamp는 락 없이 훑어본다 - 틀려도 덜 오래된 객체를 교체할 뿐
+    for (i = 0; i < NSHARDS; i++) {
+        unsigned long stamp = __atomic_load_n(&shards[i].tail_stamp, __ATOMIC_RELAXED);
+        if (stamp < oldest) {       /* Empty shards read ULONG_MAX */
+            oldest = stamp;
+            victim = &shards[i];
+        }
+    }
+    if (!victim)
+        return 0;
+
+    sp = victim;
+    P(&sp->w);
+    P(&sp->lru_mutex);
+    obj = sp->lru_tail;
+    if (obj)
+        lru_unlink(sp, obj);
+    V(&sp->lru_mutex);
+    if (!obj) {                 /* Emptied by someone else meanwhile */
+        V(&sp->w);
+        return 1;
+    }
+    for (pp = &sp->buckets[(hash(obj->uri) / NSHARDS) % NBUCKETS]; *pp != obj;
+         pp = &(*pp)->hnext)
+        ;
+    *pp = obj->hnext;
+    sp->size -= obj->size;
+    V(&sp->w);
+
+    __sync_fetch_and_sub(&cache_size, obj->size);
+    cache_release(obj);         /* Freed now unless a reader still holds it */
+    return 1;
+}
+
+/* FNV-1a string hash */
+static unsigned hash(const char *s)
+{
+    unsigned h = 2166136261u;
+
+    while (*s)
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+/* Coarse monotonic clock: cheap enough to read on every hit */
+static unsigned long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+/* LRU list helpers; caller holds sp->lru_mutex */
+static void lru_unlink(shard_t *sp, cache_obj_t *obj)
+{
+    if (obj->prev)
+        obj->prev->next = obj->next;
+    else
+        sp->lru_head = obj->next;
+    if (obj->next)
+        obj->next->prev = obj->prev;
+    else
+        sp->lru_tail = obj->prev;
+    obj->prev = obj->next = NULL;
+    __atomic_store_n(&sp->tail_stamp, sp->lru_tail ? sp->lru_tail->stamp : ULONG_MAX,
+                     __ATOMIC_RELAXED);
+}
+
+static void lru_push(shard_t *sp, cache_obj_t *obj)
+{
+    obj->prev = NULL;
+    obj->next = sp->lru_head;
+    if (sp->lru_head)
+        sp->lru_head->prev = obj;
+    else
+        sp->lru_tail = obj;
+    sp->lru_head = obj;
+    __atomic_store_n(&sp->tail_stamp, sp->lru_tail->stamp, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,31 @@
+/*
+ * cache.h - Thread-safe LRU cache of Web objects keyed by request URI
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "csapp.h"
+
+typedef struct cache_obj {
+    char *uri;                     /* Key: full request URI */
+    char *data;                    /* Cached response (headers + body) */
+    size_t size;                   /* Bytes in data */
+    size_t hdr_len;                /* Where a Connection header goes, 0: send as is */
+    int refcnt;                    /* Cache's reference + readers in flight */
+    unsigned long stamp;           /* Time of last use (ms), for global LRU */
+    struct cache_obj *hnext;       /* Next object in hash chain */
+    struct cache_obj *prev, *next; /* LRU list, most recently used first */
+} cache_obj_t;
+
+#define CACHE_WAIT_MS 3000  /* Longest a follower waits for the leader's fetch */
+
+void cache_init(void);
+cache_obj_t *cache_find(const char *uri);
+void cache_release(cache_obj_t *obj);
+void cache_insert(const char *uri, const char *data, size_t size, size_t hdr_len);
+void cache_insert_owned(const char *uri, char *data, size_t size, size_t hdr_len);
+cache_obj_t *cache_find_or_lead(const char *uri, int *leader);
+void cache_fetch_done(const char *uri);
+void cache_print_stats(void);
+
+#endif /* __CACHE_H__ */
@@ -0,0 +1,94 @@
+/*
+ * cachebench.c - Cache hit throughput versus number of threads
+ *
+ * NKEYS개의 객체를 캐시에 넣어 두고, 1, 2, 4, ... maxthreads개의 스레드가
+ * 각자 임의의 키로 cache_find / cache_release를 seconds초 동안 반복한다.
+ * 스레드 수마다 초당 히트 수(전체와 스레드당)를 출력한다 -> shard로 나눈 락 덕분에
+ * 코어가 충분하면 전체 히트 QPS가 스레드 수에 비례해서 늘어야 한다.
+ *
+ * usage: cachebench [maxthreads] [seconds]   (기본 16, 1)
+ */
+#include "cache.h"
+#include "proxy.h"
+
+#define NKEYS    200   /* Hot objects, spread over all shards */
+#define OBJSIZE  4000  /* Bytes per object */
+#define MAXTHREADS 64
+
+static volatile int stop;
+static unsigned long hits[MAXTHREADS];
+
+static void *hitter(void *vargp);
+static double now(void);
+
+int main(int argc, char **argv)
+{
+    int maxthreads = argc > 1 ? atoi(argv[1]) : 16;
+    int seconds = argc > 2 ? atoi(argv[2]) : 1;
+    static char data[OBJSIZE];
+    char uri[MAXLINE];
+    pthread_t tid[MAXTHREADS];
+    unsigned long total, base = 0;
+    double start, elapsed;
+    long nthreads, i;
+
+    if (maxthreads < 1 || maxthreads > MAXTHREADS || seconds < 1) {
+        fprintf(stderr, "usage: %s [maxthreads (1-%d)] [seconds]\n", argv[0], MAXTHREADS);
+        exit(1);
+    }
+    cache_init();
+    for (i = 0; i < NKEYS; i++) {
+        sprintf(uri, "http://bench/%ld", i);
+        cache_insert(uri, data, sizeof(data), 0);
+    }
+    printf("%ld CPUs online, %d objects, %ds per run\n",
+           sysconf(_SC_NPROCESSORS_ONLN), NKEYS, seconds);
+
+    for (nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+        stop = 0;
+        start = now();
+        for (i = 0; i < nthreads; i++)
+            Pthread_create(&tid[i], NULL, hitter, (void *)i);
+        sleep(seconds);
+        stop = 1;
+        total = 0;
+        for (i = 0; i < nthreads; i++) {
+            Pthread_join(tid[i], NULL);
+            total += hits[i];
+        }
+        elapsed = now() - start;
+        if (nthreads == 1)
+            base = total;
+        printf("threads %3ld: %10.0f hits/s  %10.0f per thread  %5.2fx\n", nthreads,
+               total / elapsed, total / elapsed / nthreads, (double)total / base);
+    }
+    return 0;
+}
+
+/* hitter - Look up random hot keys until told to stop */
+static void *hitter(void *vargp)
+{
+    long id = (long)vargp;
+    unsigned seed = id + 1;
+    unsigned long n = 0;
+    char uri[MAXLINE];
+    cache_obj_t *obj;
+
+    while (!stop) {
+        seed = seed * 1103515245 + 12345;
+        sprintf(uri, "http://bench/%u", (seed >> 8) % NKEYS);
+        if ((obj = cache_find(uri)))
+            cache_release(obj);
+        n++;
+    }
+    hits[id] = n;
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
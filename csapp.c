@@ -55,6 +55,19 @@ void app_error(char *msg) /* Application error */
 }
 /* $end errorfuns */
 
+void unix_warning(char *msg) /* Unix-style error, without exiting */
+{
+    int olderrno = errno;
+
+    fprintf(stderr, "%s: %s\n", msg, strerror(olderrno));
+    errno = olderrno;
+}
+
+void gai_warning(int code, char *msg) /* Getaddrinfo-style error, without exiting */
+{
+    fprintf(stderr, "%s: %s\n", msg, gai_strerror(code));
+}
+
 void dns_error(char *msg) /* Obsolete gethostbyname error */
 {
     fprintf(stderr, "%s\n", msg);
@@ -358,6 +371,7 @@ void Close(int fd)
 {
     int rc;
 
+    rio_flush(fd); /* Deferred rio writes go out before the close */
     if ((rc = close(fd)) < 0)
 	unix_error("Close error");
 }
@@ -742,6 +756,35 @@ void V(sem_t *sem)
  * The Rio package - Robust I/O functions
  ****************************************/
 
+/*
+ * rio_backend - Where the rio functions do their I/O. NULL means the
+ *     plain read/write/writev system calls; rio_set_backend installs
+ *     another implementation with the same semantics (see rio_uring.c).
+ *     A backend may defer writes; rio_flush(fd) and Close push them out.
+  rio_uring.c의 io_uring 백엔드는 쓰기를 모아 두었다가 다음 읽기와 함께 제출하므로,
+  rio 밖에서 같은 fd를 직접 다루기 전에는 rio_flush를 불러야 한다.
+ */
+static rio_backend_t *rio_backend;
+
+#define RIO_READ(fd, buf, n) \
+    (rio_backend ? rio_backend->read(fd, buf, n) : read(fd, buf, n))
+#define RIO_WRITE(fd, buf, n) \
+    (rio_backend ? rio_backend->write(fd, buf, n) : write(fd, buf, n))
+#define RIO_WRITEV(fd, iov, iovcnt) \
+    (rio_backend ? rio_backend->writev(fd, iov, iovcnt) : writev(fd, iov, iovcnt))
+
+/* rio_set_backend - Call before any rio I/O, while single-threaded */
+void rio_set_backend(rio_backend_t *b)
+{
+    rio_backend = b;
+}
+
+/* rio_flush - Wait until deferred writes to fd are done; -1 if one failed */
+int rio_flush(int fd)
+{
+    return rio_backend ? rio_backend->flush(fd) : 0;
+}
+
 /*
  * rio_readn - Robustly read n bytes (unbuffered)
  */
@@ -758,7 +801,7 @@ ssize_t rio_readn(int fd, void *usrbuf, size_t n)
     //남은 바이트가 0보다 크면 계속 읽음
     while (nleft > 0) { 
     //파일 디스크립터로부터 nleft만큼 읽기
-	if ((nread = read(fd, bufp, nleft)) < 0) {
+	if ((nread = RIO_READ(fd, bufp, nleft)) < 0) {
         //read(0 호출이 시그널에 의해 중단될 경우
 	    if (errno == EINTR) /* Interrupted by sig handler return */
 		    nread = 0;      /* and call read() again 다시 read()호출하기 위해 nread 0으로 설정*/
@@ -792,7 +835,7 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 
     //남은 바이트가 0보다 클 때 반복
     while (nleft > 0) {
-	if ((nwritten = write(fd, bufp, nleft)) <= 0) {
+	if ((nwritten = RIO_WRITE(fd, bufp, nleft)) <= 0) {
 	    if (errno == EINTR)  /* Interrupted by sig handler return 시그널에 의해 쓰기가 중단된 경우 */
 		    nwritten = 0;    /* and call write() again, 다시 쓰기를 시도 */
 	    else
@@ -805,6 +848,67 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 }
 /* $end rio_writen */
 
+/*
+ * rio_writev - Robustly write iovcnt buffers with writev (unbuffered)
+ 헤더 버퍼와 본문처럼 떨어져 있는 여러 버퍼를 시스템 콜 한 번(짧게 쓰이면 그 이상)으로 보냄
+ 짧은 쓰기와 EINTR은 rio_writen처럼 이어서 다시 쓴다. iov 배열은 진행 상황에 맞게 고쳐진다.
+ */
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    size_t total = 0; //지금까지 쓴 바이트 수
+    ssize_t nwritten;
+
+    while (iovcnt > 0) {
+	if ((nwritten = RIO_WRITEV(fd, iov, iovcnt)) < 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		nwritten = 0;    /* and call writev() again */
+	    else
+		return -1;       /* errno set by writev() */
+	}
+	total += nwritten;
+	//다 쓴 버퍼는 건너뛰고, 일부만 쓴 버퍼는 남은 부분부터 다시 쓰도록 조정
+	while (iovcnt > 0 && (size_t)nwritten >= iov->iov_len) {
+	    nwritten -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	}
+	if (iovcnt > 0) {
+	    iov->iov_base = (char *)iov->iov_base + nwritten;
+	    iov->iov_len -= nwritten;
+	}
+    }
+    return total; //전송한 바이트 수 반환
+}
+
+/*
+ * rio_sendfile - Robustly send count bytes of infd to outfd with
+ *     sendfile (unbuffered), starting at *offset, or at the file
+ *     position if offset is NULL. Returns the bytes sent, which is less
+ *     than count only if the file ended first, or -1 with errno set
+ *     (EINVAL: these descriptors can't be used with sendfile).
+ 파일 페이지를 커널 안에서 바로 소켓으로 보내므로 사용자 버퍼로 복사하지 않는다.
+ 짧게 보내지거나 EINTR이면 rio_writen처럼 이어서 보낸다.
+ */
+ssize_t rio_sendfile(int outfd, int infd, off_t *offset, size_t count)
+{
+    size_t nleft = count;
+    ssize_t nsent;
+
+    if (rio_flush(outfd) < 0) /* Deferred rio writes go first */
+	return -1;
+    while (nleft > 0) {
+	if ((nsent = sendfile(outfd, infd, offset, nleft)) < 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		nsent = 0;       /* and call sendfile() again */
+	    else
+		return -1;       /* errno set by sendfile() */
+	}
+	else if (nsent == 0)
+	    break;               /* EOF: the file is shorter than count */
+	nleft -= nsent;
+    }
+    return count - nleft;
+}
 
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
@@ -826,8 +930,8 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 
     //내부 버퍼에 남아있는 바이트의 수 <= 0이면 -> read() 함수를 통해 내부 버퍼를 다시 채운다.
     while (rp->rio_cnt <= 0) {  /* Refill if buf is empty */
-	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
-			   sizeof(rp->rio_buf));
+	rp->rio_cnt = RIO_READ(rp->rio_fd, rp->rio_buf, 
+			   rp->rio_bufsize);
 	if (rp->rio_cnt < 0) {
 	    if (errno != EINTR) /* Interrupted by sig handler return */
 		return -1;
@@ -852,20 +956,124 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 }
 /* $end rio_read */
 
+/*
+ * Rio buffer pool - rio_t의 내부 버퍼는 크기별(2의 거듭제곱) free list에서 빌려 온다.
+ * 연결이 끝나 rio_release로 돌려준 버퍼는 다음 연결이 다시 쓴다 (클래스마다 RIO_POOLMAX개까지 보관).
+ * 버퍼 앞부분을 free list의 next 포인터로 쓴다. 스레드가 공유하므로 세마포어로 보호.
+ */
+#define RIO_NCLASSES 11         /* 1KB, 2KB, ..., 1MB */
+#define RIO_POOLMAX 64          /* Free buffers kept per class */
+
+static char *rio_freelist[RIO_NCLASSES];
+static int rio_nfree[RIO_NCLASSES];
+static sem_t rio_pool_mutex;
+static pthread_once_t rio_pool_once = PTHREAD_ONCE_INIT;
+
+static void rio_pool_init(void)
+{
+    Sem_init(&rio_pool_mutex, 0, 1);
+}
+
+/* Size class holding at least size bytes; *bufsize gets its size */
+static int rio_class(size_t size, size_t *bufsize)
+{
+    int c = 0;
+
+    for (*bufsize = RIO_MINBUFSIZE; *bufsize < size && c < RIO_NCLASSES - 1; c++)
+	*bufsize <<= 1;
+    return c;
+}
+
+static char *rio_buf_get(size_t size, size_t *bufsize)
+{
+    int c = rio_class(size, bufsize);
+    char *buf;
+
+    Pthread_once(&rio_pool_once, rio_pool_init);
+    P(&rio_pool_mutex);
+    if ((buf = rio_freelist[c]) != NULL) {
+	rio_freelist[c] = *(char **)buf;
+	rio_nfree[c]--;
+    }
+    V(&rio_pool_mutex);
+    return buf ? buf : Malloc(*bufsize);
+}
+
+static void rio_buf_put(char *buf, size_t bufsize)
+{
+    size_t size;
+    int c = rio_class(bufsize, &size);
+
+    P(&rio_pool_mutex);
+    if (rio_nfree[c] < RIO_POOLMAX) {
+	*(char **)buf = rio_freelist[c];
+	rio_freelist[c] = buf;
+	rio_nfree[c]++;
+	buf = NULL;
+    }
+    V(&rio_pool_mutex);
+    free(buf);
+}
+
 /*
  * rio_readinitb - Associate a descriptor with a read buffer and reset buffer
- 파일 디스크립터를 읽기 버퍼와 연결하고 버퍼를 초기화 
+ 파일 디스크립터를 읽기 버퍼와 연결하고 버퍼를 초기화 (기본 크기 RIO_BUFSIZE)
+ 다 쓰면 rio_release로 버퍼를 돌려줘야 한다.
  */
 /* $begin rio_readinitb */
 void rio_readinitb(rio_t *rp, int fd) 
 {
-    rp->rio_fd = fd;  //파일 디스크립터 설정
-    rp->rio_cnt = 0;  // rio_cnt :내부 버퍼에 남아있는 바이트 수 => 0으로 초기화 
-    rp->rio_bufptr = rp->rio_buf; //버퍼 포인터를 내부 버퍼의 시작 위치로 설정. 
-    // 데이터 읽기 시작할 위치를 내부 버퍼의 처음으로 지정
+    rio_readinitb_sz(rp, fd, RIO_BUFSIZE);
 }
 /* $end rio_readinitb */
 
+/*
+ * rio_readinitb_sz - rio_readinitb with a buffer of at least size bytes
+ 본문을 스트리밍하는 연결은 크게(read 횟수 감소), 유휴 keep-alive 연결은 작게(메모리 절약)
+ */
+void rio_readinitb_sz(rio_t *rp, int fd, size_t size)
+{
+    rp->rio_fd = fd;  
+    rp->rio_cnt = 0;  
+    rp->rio_buf = rio_buf_get(size, &rp->rio_bufsize);
+    rp->rio_bufptr = rp->rio_buf;
+}
+
+/*
+ * rio_resize - Switch rp to a buffer of at least size bytes, keeping the
+ *     unread bytes. Returns 0, or -1 (buffer unchanged) if they don't fit.
+ 아직 읽지 않은 바이트는 새 버퍼로 옮긴다
+ */
+int rio_resize(rio_t *rp, size_t size)
+{
+    size_t bufsize;
+    char *buf;
+
+    rio_class(size, &bufsize);
+    if (bufsize == rp->rio_bufsize)
+	return 0;
+    if (rp->rio_cnt > 0 && (size_t)rp->rio_cnt > bufsize)
+	return -1;
+    buf = rio_buf_get(size, &bufsize);
+    if (rp->rio_cnt > 0)
+	memcpy(buf, rp->rio_bufptr, rp->rio_cnt);
+    rio_buf_put(rp->rio_buf, rp->rio_bufsize);
+    rp->rio_buf = rp->rio_bufptr = buf;
+    rp->rio_bufsize = bufsize;
+    return 0;
+}
+
+/*
+ * rio_release - Return rp's buffer to the pool 버퍼를 풀에 돌려줌 (rp는 다시 init해야 쓸 수 있다)
+ */
+void rio_release(rio_t *rp)
+{
+    if (rp->rio_buf)
+	rio_buf_put(rp->rio_buf, rp->rio_bufsize);
+    rp->rio_buf = rp->rio_bufptr = NULL;
+    rp->rio_cnt = 0;
+}
+
 
 /*
  * rio_readnb - Robustly read n bytes (buffered)
@@ -902,29 +1110,38 @@ maxlen: 최대로 읽을 수 있는 바이트 수 - 버퍼의 크기
 */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
-
-    for (n = 1; n < maxlen; n++) { 
-        //rio_read()를 통해 문자 하나 읽고, 성공적으로 읽었으면 실행
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-	    *bufp++ = c; //읽은 문자를 사용자 버퍼에 저장
-        // 만약 읽은 문자가 \n이면 
-	    if (c == '\n') {
-                n++; //읽은 바이트 수 하나 증가시키고 반복 종료
-     		break;
+    size_t n, cnt;
+    ssize_t rc;
+    char *bufp = usrbuf, *nl;
+
+    for (n = 0; n + 1 < maxlen; ) {
+        //내부 버퍼가 비었을 때만 rio_read()로 다시 채운다 (첫 바이트를 같이 읽음)
+        if (rp->rio_cnt <= 0) {
+            if ((rc = rio_read(rp, bufp, 1)) < 0)
+                return -1;      /* Error */
+            if (rc == 0)
+                break;          /* EOF: 읽은 게 없으면 n == 0 반환 */
+            n++;
+            if (*bufp++ == '\n')
+                break;
+            continue;
         }
-    //rio_read() 반환 값이 0이면 EOF에 도달한 것
-	} else if (rc == 0) {
-	    if (n == 1) //만약 아무 데이터도 읽지 않았으면
-		return 0; /* EOF, no data read - 0반환, 데이터가 없음*/
-	    else //데이터 일부를 읽었으면 반복 종료
-		break;    /* EOF, some data was read */
-	} else //rio_read에서 -1 반환하면 -> 오류가 발생한 것
-	    return -1;	  /* Error */
+        //내부 버퍼에 남은 바이트에서 memchr로 '\n'을 찾아 줄 전체를 memcpy 한 번으로 복사
+        cnt = maxlen - 1 - n;
+        if (rp->rio_cnt < cnt)
+            cnt = rp->rio_cnt;
+        if ((nl = memchr(rp->rio_bufptr, '\n', cnt)))
+            cnt = nl - rp->rio_bufptr + 1;
+        memcpy(bufp, rp->rio_bufptr, cnt);
+        rp->rio_bufptr += cnt;
+        rp->rio_cnt -= cnt;
+        bufp += cnt;
+        n += cnt;
+        if (nl)
+            break;
     }
     *bufp = 0; //사용자 버퍼의 마지막에 문자열의 끝을 알리기위해 널 문자('\0') 추가
-    return n-1; //실제로 읽은 바이트 수 정확히 반환하기 위해 읽은 바이트 수에서 1 빼서 반환
+    return n; //읽은 바이트 수 ('\n' 포함, 널 문자 제외)
 }
 /* $end rio_readlineb */
 
@@ -946,6 +1163,12 @@ void Rio_writen(int fd, void *usrbuf, size_t n)
 	unix_error("Rio_writen error");
 }
 
+void Rio_writev(int fd, struct iovec *iov, int iovcnt) 
+{
+    if (rio_writev(fd, iov, iovcnt) < 0)
+	unix_error("Rio_writev error");
+}
+
 void Rio_readinitb(rio_t *rp, int fd)
 {
     rio_readinitb(rp, fd);
@@ -1033,6 +1256,26 @@ int open_clientfd(char *hostname, char *port) {
  */
 /* $begin open_listenfd */
 int open_listenfd(char *port) 
+{
+    return open_listenfd_ex(port, LISTENQ, 0);
+}
+/* $end open_listenfd */
+
+/*
+ * open_listenfd_ex - open_listenfd with a listen() backlog (LISTENQ if
+ *     backlog <= 0) and LISTEN_* flags:
+ *       LISTEN_REUSEPORT  set SO_REUSEPORT, so each worker thread or
+ *                         process can open its own listener on port
+ *       LISTEN_DEFER_ACCEPT  set TCP_DEFER_ACCEPT: accept() returns a
+ *                         connection only once its first data has
+ *                         arrived (or after LISTEN_DEFER_SECS)
+ *       LISTEN_FASTOPEN   set TCP_FASTOPEN with a queue of backlog, so
+ *                         returning clients can send the request in
+ *                         the SYN
+ *  워커마다 자기 리스닝 소켓(= 자기 accept 큐)을 가지면 accept 큐 하나를 두고
+ *  경쟁하지 않고, 새 연결 하나에 여러 워커가 깨어나지도 않는다.
+ */
+int open_listenfd_ex(char *port, int backlog, int flags)
 {
     struct addrinfo hints, *listp, *p;
     int listenfd, rc, optval=1;
@@ -1060,6 +1303,15 @@ int open_listenfd(char *port)
         setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,    //line:netp:csapp:setsockopt
                    (const void *)&optval , sizeof(int));
 
+        //LISTEN_REUSEPORT: 같은 포트에 소켓을 여러 개 열 수 있게 함 -> 커널이 새 연결을 소켓들에 나눠 준다
+        /* Let several listeners share the port; the kernel balances accepts */
+        if ((flags & LISTEN_REUSEPORT) &&
+            setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+                       (const void *)&optval, sizeof(int)) < 0) {
+            close(listenfd);
+            continue;
+        }
+
         //bind를 활용하여 포트번호를 ip주소에 묶음
         /* Bind the descriptor to the address */
         if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0)
@@ -1076,15 +1328,28 @@ int open_listenfd(char *port)
     if (!p) /* No address worked 모든 주소 시도 실패*/
         return -1;
 
+    //둘 다 최적화 힌트일 뿐이라 커널이 지원하지 않아도(tcp_fastopen sysctl 등) 실패로 보지 않는다
+    /* Both are hints: a kernel that refuses them still gets a listener */
+    if (flags & LISTEN_DEFER_ACCEPT) {
+        optval = LISTEN_DEFER_SECS;
+        setsockopt(listenfd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                   (const void *)&optval, sizeof(int));
+    }
+    if (flags & LISTEN_FASTOPEN) {
+        optval = backlog > 0 ? backlog : LISTENQ;
+        setsockopt(listenfd, IPPROTO_TCP, TCP_FASTOPEN,
+                   (const void *)&optval, sizeof(int));
+    }
+
     /* Make it a listening socket ready to accept connection requests */
     // 듣기 소켓을 준비하여 연결 요청을 수락할 준비
-    if (listen(listenfd, LISTENQ) < 0) {
+    if (listen(listenfd, backlog > 0 ? backlog : LISTENQ) < 0) {
         close(listenfd);
 	return -1;
     }
     return listenfd;
 }
-/* $end open_listenfd */
+/* $end open_listenfd_ex */
 
 /****************************************************
  * Wrappers for reentrant protocol-independent helpers
@@ -1107,6 +1372,112 @@ int Open_listenfd(char *port)
     return rc;
 }
 
+int Open_listenfd_ex(char *port, int backlog, int flags) 
+{
+    int rc;
+
+    if ((rc = open_listenfd_ex(port, backlog, flags)) < 0)
+	unix_error("Open_listenfd error");
+    return rc;
+}
+
+/****************************************************
+ * Non-terminating wrappers for long-running servers
+ ****************************************************/
+/*
+ * The _e wrappers report errors the way the wrappers above do, but
+ * return instead of exiting: -1 with errno set (Getnameinfo_e returns
+ * the getaddrinfo-style code). Use them for anything a peer can make
+ * fail, so one reset connection only ends its own transaction.
+ 피어 하나가 연결을 끊었다고(ECONNRESET, EPIPE) 서버 프로세스 전체가 exit하지 않도록,
+ 대문자 래퍼처럼 에러를 출력하되 종료하지 않고 호출자에게 돌려준다.
+ */
+/* $begin server_init */
+/*
+ * Server_init - Process-wide setup for a long-running server. Writing
+ *     to a socket the peer has reset raises SIGPIPE, whose default
+ *     action kills the process; ignore it so the write returns EPIPE.
+ */
+void Server_init(void)
+{
+    Signal(SIGPIPE, SIG_IGN);
+}
+/* $end server_init */
+
+int Accept_e(int s, struct sockaddr *addr, socklen_t *addrlen) 
+{
+    int rc;
+
+    if ((rc = accept(s, addr, addrlen)) < 0)
+	unix_warning("Accept error");
+    return rc;
+}
+
+int Getnameinfo_e(const struct sockaddr *sa, socklen_t salen, char *host, 
+                  size_t hostlen, char *serv, size_t servlen, int flags)
+{
+    int rc;
+
+    if ((rc = getnameinfo(sa, salen, host, hostlen, serv, 
+                          servlen, flags)) != 0) 
+        gai_warning(rc, "Getnameinfo error");
+    return rc;
+}
+
+int Open_clientfd_e(char *hostname, char *port) 
+{
+    int rc;
+
+    if ((rc = open_clientfd(hostname, port)) < 0) 
+	unix_warning("Open_clientfd error");
+    return rc;
+}
+
+ssize_t Rio_readn_e(int fd, void *ptr, size_t nbytes) 
+{
+    ssize_t n;
+  
+    if ((n = rio_readn(fd, ptr, nbytes)) < 0)
+	unix_warning("Rio_readn error");
+    return n;
+}
+
+ssize_t Rio_writen_e(int fd, void *usrbuf, size_t n) 
+{
+    ssize_t rc;
+
+    if ((rc = rio_writen(fd, usrbuf, n)) < 0)
+	unix_warning("Rio_writen error");
+    return rc;
+}
+
+ssize_t Rio_writev_e(int fd, struct iovec *iov, int iovcnt) 
+{
+    ssize_t rc;
+
+    if ((rc = rio_writev(fd, iov, iovcnt)) < 0)
+	unix_warning("Rio_writev error");
+    return rc;
+}
+
+ssize_t Rio_readnb_e(rio_t *rp, void *usrbuf, size_t n) 
+{
+    ssize_t rc;
+
+    if ((rc = rio_readnb(rp, usrbuf, n)) < 0)
+	unix_warning("Rio_readnb error");
+    return rc;
+}
+
+ssize_t Rio_readlineb_e(rio_t *rp, void *usrbuf, size_t maxlen) 
+{
+    ssize_t rc;
+
+    if ((rc = rio_readlineb(rp, usrbuf, maxlen)) < 0)
+	unix_warning("Rio_readlineb error");
+    return rc;
+} 
+
 /* $end csapp.c */
 
 
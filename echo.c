@@ -3,7 +3,7 @@
 
 //클라이언트로부터 데이터를 받아 동일한 
 void echo(int connfd) {
-    size_t n;
+    ssize_t n;
     char buf[MAXLINE];
     rio_t rio;
 
@@ -11,8 +11,11 @@ void echo(int connfd) {
 
     //클라이언트로부터 한줄 씩 읽기 - 반환값이 0이면 클라이언트가 연결을 닫았음을 의미
     //loop는 클라이언트 연결이 닫힐 때까지 계속
-    while((n = Rio_readlineb(&rio, buf, MAXLINE)) != 0) { 
+    //읽기/쓰기 에러(클라이언트의 연결 리셋 등)면 이 연결만 끝낸다 -> 서버는 다음 연결을 계속 받음
+    while((n = Rio_readlineb_e(&rio, buf, MAXLINE)) > 0) { 
         printf("server received %d bytes\n", (int)n); //서버가 받은 데이터의 바이트 수 출력
-        Rio_writen(connfd, buf, n); //받은 데이터를 그대로 다시 보내기
+        if (Rio_writen_e(connfd, buf, n) < 0) //받은 데이터를 그대로 다시 보내기
+            break;
     }
+    rio_release(&rio); //읽기 버퍼를 풀에 돌려줌
 }
\ No newline at end of file
@@ -28,6 +28,7 @@ int main(int argc, char **argv) {
         Rio_readlineb(&rio, buf, MAXLINE); //서버로부터 응답을 받음 
         Fputs(buf, stdout); //받은 응답을 표준 출력으로 출력
     }
+    rio_release(&rio); //읽기 버퍼를 풀에 돌려줌
     Close(clientfd); //클라이언트 소켓을 닫음
     exit(0); //클라이언트 종료
 }
@@ -1,6 +1,9 @@
 #include "csapp.h"
 
 void echo(int connfd);
+void sigusr1_handler(int sig);
+
+static volatile long nwakeups, naccepts; //poll에서 깨어난 횟수, accept한 연결 수 (SIGUSR1로 출력)
 
 int main(int argc, char **argv) {
     int listenfd, connfd; //서버의 리스닝 소켓, 연결 소켓 파일 디스크립터
@@ -9,26 +12,76 @@ int main(int argc, char **argv) {
 
     struct sockaddr_storage clientaddr; //클라이언트 주소 정보를 저장할 구조체
     char client_hostname[MAXLINE], client_port[MAXLINE]; //클라이언트 호스트 이름, 포트 번호 저장할 배열
+    int opt, backlog = LISTENQ, flags = 0;
+    struct pollfd pfd;
 
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s <port>\n", argv[0]);
+    // ./echoserver [-l backlog] [-r] [-d] [-f] <port>  (-r: SO_REUSEPORT, 같은 포트에 서버를 여러 개 띄울 수 있음)
+    // -d: TCP_DEFER_ACCEPT (첫 줄이 도착한 연결만 accept), -f: TCP_FASTOPEN
+    while ((opt = getopt(argc, argv, "l:rdf")) != -1) {
+        if (opt == 'l')
+            backlog = atoi(optarg);
+        else if (opt == 'r')
+            flags |= LISTEN_REUSEPORT;
+        else if (opt == 'd')
+            flags |= LISTEN_DEFER_ACCEPT;
+        else if (opt == 'f')
+            flags |= LISTEN_FASTOPEN;
+        else
+            optind = argc;
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-l backlog] [-r] [-d] [-f] <port>\n", argv[0]);
         exit(0);
     }
 
+    Server_init(); //끊긴 클라이언트에 쓰다가 SIGPIPE로 죽지 않도록
+    Signal(SIGUSR1, sigusr1_handler); //kill -USR1 <pid> 로 accept 통계 출력
+
     //리스닝 소켓을 열고, 저장된 포트에서 연결 기다림
-    listenfd = Open_listenfd(argv[1]);
+    listenfd = Open_listenfd_ex(argv[optind], backlog, flags);
+
+    //리스닝 소켓은 논블로킹 - poll에서 한 번 깨어나면 대기 중인 연결을 EAGAIN이 날 때까지 모두 받는다
+    fcntl(listenfd, F_SETFL, O_NONBLOCK);
+    pfd.fd = listenfd;
+    pfd.events = POLLIN;
 
     while (1) {//무한 루프를 통해 연속적으로 클라이언트의 연결을 받아들임
-        clientlen = sizeof(struct sockaddr_storage); //초기화
+        if (poll(&pfd, 1, -1) < 0)
+            continue; //EINTR (SIGUSR1)
+        nwakeups++;
+        while (1) {
+            clientlen = sizeof(struct sockaddr_storage); //초기화
 
-        connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen); //클라이언트로부터의 연결 요청 수락
+            //클라이언트로부터의 연결 요청 수락 - 연결 소켓은 블로킹 그대로 (echo가 블로킹 rio를 씀)
+            if ((connfd = accept4(listenfd, (SA *)&clientaddr, &clientlen, SOCK_CLOEXEC)) < 0) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    unix_warning("Accept error"); //실패해도 서버를 끝내지 않고 다음 연결을 기다림
+                break; //대기 중인 연결을 다 받음
+            }
+            naccepts++;
 
-        //클라이언트 주소 정보를 기반으로 호스트 이름과 포트 번호 알아냄
-        Getnameinfo((SA *) &clientaddr, clientlen, client_hostname, MAXLINE, client_port, MAXLINE, 0);
-        //연결된 클라이언트 정보 출력
-        printf("Connected to (%s, %s )\n", client_hostname, client_port);
-        echo(connfd); //에코 함수를 호출해서 클라리언트와 데이터 송수신 수행
-        Close(connfd); //데이터 송수신이 끝난 후 연결 소켓 닫음
+            //클라이언트 주소 정보를 기반으로 호스트 이름과 포트 번호 알아냄
+            if (Getnameinfo_e((SA *) &clientaddr, clientlen, client_hostname, MAXLINE, client_port, MAXLINE, 0) != 0) {
+                strcpy(client_hostname, "?");
+                strcpy(client_port, "?");
+            }
+            //연결된 클라이언트 정보 출력
+            printf("Connected to (%s, %s )\n", client_hostname, client_port);
+            echo(connfd); //에코 함수를 호출해서 클라리언트와 데이터 송수신 수행
+            Close(connfd); //데이터 송수신이 끝난 후 연결 소켓 닫음
+        }
     }    
     exit(0);
-}
\ No newline at end of file
+}
+
+void sigusr1_handler(int sig) {
+    int olderrno = errno;
+    sio_puts("accept: wakeups ");
+    sio_putl(nwakeups);
+    sio_puts(" accepts ");
+    sio_putl(naccepts);
+    sio_puts("\n");
+    errno = olderrno;
+}
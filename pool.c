@@ -0,0 +1,165 @@
+/*
+ * pool.c - Pool of idle keep-alive connections to origin servers
+ *
+ * 원 서버(host:port)마다 재사용 가능한 유휴 연결을 스택(LIFO)으로 보관한다.
+ * 요청마다 getaddrinfo + socket + connect(TCP 핸드셰이크)를 하는 대신 pool_get으로
+ * 꺼내 쓰고, 응답을 끝까지 읽은 연결은 pool_put으로 돌려놓는다.
+ *  - 원 서버마다 최대 max_idle개까지만 보관하고, 넘치는 연결은 닫는다.
+ *  - idle_timeout초 넘게 쉬고 있던 연결은 버린다 (서버도 곧 닫을 연결).
+ *  - 꺼낼 때 MSG_PEEK로 확인해서 서버가 이미 FIN을 보냈거나(half-close)
+ *    요청하지도 않은 데이터가 와 있는 연결은 재사용하지 않는다.
+ * 버리는 연결은 Close로 닫는다 -> rio 백엔드가 그 fd에 대해 기억한 상태도 지워진다.
+ */
+#include "pool.h"
+
+#define NBUCKETS 64  /* Hash buckets for origins (power of 2) */
+
+typedef struct idle_conn {
+    int fd;
+    time_t since;                 /* When it went idle */
+    struct idle_conn *next;
+} idle_conn_t;
+
+typedef struct origin {
+    char *key;                    /* "host:port" */
+    int nidle;                    /* Length of the idle list */
+    idle_conn_t *idle;            /* Most recently used first */
+    struct origin *next;          /* Next origin in hash chain */
+} origin_t;
+
+static origin_t *buckets[NBUCKETS];
+static int max_idle = POOL_MAX_IDLE;
+static int idle_timeout = POOL_IDLE_TIMEOUT;
+static time_t last_sweep;
+static sem_t mutex;               /* Protects everything above */
+
+static origin_t *find_origin(const char *host, const char *port, int create);
+static void sweep(time_t now);
+static int is_alive(int fd);
+
+void pool_init(int maxidle, int timeout)
+{
+    max_idle = maxidle;
+    idle_timeout = timeout;
+    Sem_init(&mutex, 0, 1);
+}
+
+//pool_get - host:port로 가는 살아 있는 유휴 연결을 꺼내 반환, 없으면 -1
+int pool_get(const char *host, const char *port)
+{
+    origin_t *op;
+    idle_conn_t *ic;
+    time_t now;
+    int fd;
+
+    while (1) {
+        now = time(NULL);
+        P(&mutex);
+        sweep(now);
+        op = find_origin(host, port, 0);
+        if (!op || !op->idle) {
+            V(&mutex);
+            return -1;
+        }
+        ic = op->idle;
+        op->idle = ic->next;
+        op->nidle--;
+        V(&mutex);
+
+        //살아 있는지 확인은 락 밖에서 - 죽은 연결이면 버리고 다음 것을 본다
+        fd = ic->fd;
+        Free(ic);
+        if (is_alive(fd))
+            return fd;
+        Close(fd);
+    }
+}
+
+//pool_put - 응답을 끝까지 읽은 연결을 돌려놓는다. 자리가 없으면 닫는다.
+void pool_put(const char *host, const char *port, int fd)
+{
+    origin_t *op;
+    idle_conn_t *ic;
+    time_t now = time(NULL);
+
+    P(&mutex);
+    sweep(now);
+    op = find_origin(host, port, 1);
+    if (op->nidle >= max_idle) {
+        V(&mutex);
+        Close(fd);
+        return;
+    }
+    ic = Malloc(sizeof(idle_conn_t));
+    ic->fd = fd;
+    ic->since = now;
+    ic->next = op->idle;
+    op->idle = ic;
+    op->nidle++;
+    V(&mutex);
+}
+
+/* find_origin - Look up the entry for host:port; caller holds mutex */
+static origin_t *find_origin(const char *host, const char *port, int create)
+{
+    char key[MAXLINE];
+    unsigned h = 2166136261u;     /* FNV-1a */
+    origin_t *op;
+    char *s;
+
+    snprintf(key, sizeof(key), "%s:%s", host, port);
+    for (s = key; *s; s++)
+        h = (h ^ (unsigned char)*s) * 16777619u;
+    h &= NBUCKETS - 1;
+
+    for (op = buckets[h]; op; op = op->next)
+        if (!strcmp(op->key, key))
+            return op;
+    if (!create)
+        return NULL;
+    op = Calloc(1, sizeof(origin_t));
+    op->key = Malloc(strlen(key) + 1);
+    strcpy(op->key, key);
+    op->next = buckets[h];
+    buckets[h] = op;
+    return op;
+}
+
+/*
+ * sweep - Close connections idle longer than idle_timeout.
+ *     Runs at most once a second; caller holds mutex.
+ */
+static void sweep(time_t now)
+{
+    origin_t *op;
+    idle_conn_t **pp, *ic;
+    int i;
+
+    if (now == last_sweep)
+        return;
+    last_sweep = now;
+    for (i = 0; i < NBUCKETS; i++)
+        for (op = buckets[i]; op; op = op->next)
+            for (pp = &op->idle; (ic = *pp); ) {
+                if (now - ic->since > idle_timeout) {
+                    *pp = ic->next;
+                    op->nidle--;
+                    Close(ic->fd);
+                    Free(ic);
+                }
+                else
+                    pp = &ic->next;
+            }
+}
+
+/*
+ * is_alive - An idle connection is reusable only if a non-blocking peek
+ *     would block: 0 means the origin half-closed, data means garbage.
+ */
+static int is_alive(int fd)
+{
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
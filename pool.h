@@ -0,0 +1,16 @@
+/*
+ * pool.h - Pool of idle keep-alive connections to origin servers
+ */
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include "csapp.h"
+
+#define POOL_MAX_IDLE     8   /* Default max idle connections per origin */
+#define POOL_IDLE_TIMEOUT 30  /* Default seconds an idle connection is kept */
+
+void pool_init(int max_idle, int idle_timeout);
+int pool_get(const char *host, const char *port);
+void pool_put(const char *host, const char *port, int fd);
+
+#endif /* __POOL_H__ */
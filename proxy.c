@@ -1,15 +1,792 @@
-#include <stdio.h>
+/*
+ * proxy.c - A prethreaded, concurrent HTTP/1.1 Web proxy
+ *
+ * 메인 스레드는 accept만 담당하고, 연결 식별자(connfd)를 제한된 크기의
+ * 공유 버퍼(sbuf)에 넣는다. 미리 만들어 둔 고정 개수의 워커 스레드가
+ * sbuf에서 connfd를 꺼내 그 연결의 HTTP 트랜잭션을 처리한다.
+ * 클라이언트 연결은 HTTP/1.1 keep-alive로 유지되고, 파이프라인된 요청도 순서대로 처리한다.
+ * -> 연결마다 스레드를 만들지 않으므로 동시 접속이 많아도 스레드 수가 일정하고,
+ *    응답하지 않는 서버(nop-server)에 묶인 워커는 하나뿐이라 다른 요청은 계속 처리된다.
+ *
+ * GET 응답(200)은 MAX_OBJECT_SIZE 이하이면 cache.c의 객체 캐시에 저장되고,
+ * 같은 URI 요청은 원 서버에 연결하지 않고 캐시에서 바로 응답한다.
+ * 같은 URI의 미스가 동시에 몰리면 하나만 원 서버에 가고 나머지는 그 결과를 기다린다.
+ * 응답은 받는 즉시 클라이언트에게 전달하면서 캐시용 복사본(objbuf_t)에도 붙인다.
+ * 복사본은 Content-Length가 있으면 그 크기로 한 번에, 없으면 필요할 때마다 늘려서 할당한다.
+ *
+ * 원 서버와는 HTTP/1.1 keep-alive로 통신하고, 응답을 경계(Content-Length / chunked)까지
+ * 정확히 읽은 연결은 pool.c에 돌려놓았다가 같은 host:port 요청에 재사용한다 (-K로 끄기).
+ *
+ * 캐시하지 않는 본문(너무 크거나 200이 아닌 응답)은 splice_relay.c로 사용자 공간 복사 없이
+ * 원 서버 소켓에서 클라이언트 소켓으로 옮긴다 (-S로 끄기).
+ *
+ * 요청 하나에 필요한 문자열과 요청/응답 헤더 버퍼는 워커마다 하나씩 있는 arena(arena.c)에서
+ * 잘라 쓰고 요청이 끝나면 한 번에 비운다 -> malloc 경쟁이 없고 워커 스택을 작게(THREAD_STACK) 잡을 수 있다.
+ *
+ * -e epoll -r이면 이벤트 루프마다 SO_REUSEPORT 리스닝 소켓을 따로 열고 각자 accept한다
+ * -> 커널이 새 연결을 루프들에 나눠 주므로 accept 큐 하나를 두고 루프들이 경쟁하지 않는다.
+ * (스레드 엔진에는 쓰지 않는다: 블록된 워커의 큐에 배정된 연결은 그 워커가 풀릴 때까지 기다려야 한다)
+ *
+ * -e epoll 옵션을 주면 스레드 풀 대신 proxy_event.c의 epoll 이벤트 루프 엔진으로 동작한다.
+ */
+#include <netinet/tcp.h>
+#include "csapp.h"
+#include "sbuf.h"
+#include "cache.h"
+#include "pool.h"
+#include "resolve.h"
+#include "splice_relay.h"
+#include "rio_uring.h"
+#include "rewrite.h"
+#include "arena.h"
+#include "proxy.h"
 
-/* Recommended max cache and object sizes */
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
+#define NTHREADS 16  /* Default number of worker threads 기본 워커 스레드 수 */
+#define SBUFSIZE 64  /* Default number of connection queue slots 기본 연결 큐 크기 */
 
-/* You won't lose style points for including this long line in your code */
-static const char *user_agent_hdr =
-    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 "
-    "Firefox/10.0.3\r\n";
+#define HEADSIZE (4*MAXLINE)  /* Max response head forwarded to a client */
+#define HEADROOM 64           /* Kept free in a head for Transfer-Encoding and Connection */
+#define CLIENT_BUFSIZE 2048   /* Default rio buffer for client connections */
+#define ORIGIN_BUFSIZE 65536  /* Default rio buffer for origin connections */
+#define ARENA_SIZE (96*1024)  /* Arena block kept by each worker: request + response heads */
+#define THREAD_STACK (256*1024) /* Worker stack; per-request buffers live in the arena */
 
-int main() {
-  printf("%s", user_agent_hdr);
+/* One client request 클라이언트 요청 하나 - 문자열과 버퍼는 모두 arena 안에 있다 */
+typedef struct {
+  char *method, *uri, *version;
+  char *hostname, *port, *path;
+  reqbuf_t *rb;    /* Request rewritten for the origin */
+  arena_t *arena;  /* Per-request storage, reset before the next request */
+  int http11;      /* Client speaks HTTP/1.1 */
+  int keepalive;   /* Keep the client connection open after the response */
+} req_t;
+
+/* How the origin frames a response body 응답 본문의 경계를 정하는 정보 */
+typedef struct {
+  int status;      /* Status code */
+  int keepalive;   /* Origin keeps the connection open after this response */
+  int chunked;     /* Transfer-Encoding: chunked */
+  long length;     /* Content-Length, -1 if absent */
+  int nobody;      /* No body: HEAD, 1xx, 204, 304 */
+} resp_t;
+
+void *thread(void *vargp);
+void sigusr1_handler(int sig);
+void serve(int fd, arena_t *arena);
+int doit(int fd, rio_t *rp, arena_t *arena, int more);
+int read_requesthdrs(rio_t *rp, req_t *req);
+int forward(int fd, req_t *req, objbuf_t *ob);
+int send_cached(int fd, cache_obj_t *obj, int keepalive);
+int send_head(int fd, char *head, size_t len, rio_t *rp, resp_t *resp, objbuf_t *ob);
+int connect_origin(char *hostname, char *port, int *reused);
+ssize_t read_responsehdrs(rio_t *rp, char *head, resp_t *resp, int is_head);
+int relay_body(rio_t *rp, int fd, resp_t *resp, objbuf_t *ob, int dechunk);
+int splice_body(rio_t *rp, int fd, long *left);
+int send_client(int fd, char *buf, size_t n, objbuf_t *ob);
+void clienterror(int fd, char *cause, char *errnum, char *shortmsg,
+                 char *longmsg);
+
+sbuf_t sbuf; /* Shared buffer of connected descriptors 연결 식별자 공유 버퍼 */
+int upstream_keepalive = 1; /* Reuse origin connections via pool.c 원 서버 연결 재사용 여부 */
+int use_splice = 1;         /* Relay uncached bodies with splice() */
+//rio 버퍼 크기 (-b / -B) - 클라이언트 쪽은 요청 헤더만 읽고 대부분 유휴 keep-alive로 기다리므로 작게,
+//원 서버 쪽은 본문을 읽으므로 크게 -> read 횟수가 줄어든다. 버퍼는 csapp의 rio 버퍼 풀에서 재사용
+size_t client_bufsize = CLIENT_BUFSIZE;
+size_t origin_bufsize = ORIGIN_BUFSIZE;
+static unsigned long spliced_bytes; /* Bytes relayed by splice_body */
+
+int main(int argc, char **argv) {
+  int i, opt, *listenfds, connfd;
+  int nthreads = NTHREADS, nslots = SBUFSIZE, use_epoll = 0;
+  int backlog = LISTENQ, reuseport = 0, use_uring = 0;
+  char hostname[MAXLINE], port[MAXLINE];
+  socklen_t clientlen;
+  struct sockaddr_storage clientaddr;
+  pthread_t tid;
+  pthread_attr_t attr;
+
+  /* Check command line args */
+  // ./proxy [-e thread|epoll] [-t 워커(이벤트 루프) 수] [-q 큐 크기] [-l backlog] [-r] [-K] [-S] [-U] <port>
+  while ((opt = getopt(argc, argv, "e:t:q:b:B:l:rKSU")) != -1) {
+    switch (opt) {
+    case 'K':
+      upstream_keepalive = 0; //원 서버 연결을 매번 닫는다
+      break;
+    case 'S':
+      use_splice = 0; //본문을 항상 rio 버퍼로 복사해서 전달
+      break;
+    case 'U':
+      use_uring = 1; //rio I/O와 (epoll 엔진의) accept를 io_uring으로
+      break;
+    case 'e':
+      if (!strcmp(optarg, "epoll"))
+        use_epoll = 1;
+      else if (strcmp(optarg, "thread"))
+        optind = argc;
+      break;
+    case 't':
+      nthreads = atoi(optarg);
+      break;
+    case 'q':
+      nslots = atoi(optarg);
+      break;
+    case 'b':
+      client_bufsize = atol(optarg);
+      break;
+    case 'B':
+      origin_bufsize = atol(optarg);
+      break;
+    case 'l':
+      backlog = atoi(optarg); //listen() backlog
+      break;
+    case 'r':
+      reuseport = 1; //이벤트 루프마다 SO_REUSEPORT 리스닝 소켓 (-e epoll 전용)
+      break;
+    default:
+      optind = argc; /* usage 출력으로 */
+      break;
+    }
+  }
+  if (optind != argc - 1 || nthreads <= 0 || nslots <= 0 || (reuseport && !use_epoll)) {
+    fprintf(stderr, "usage: %s [-e thread|epoll] [-t nthreads] [-q queuesize] [-b clientbuf] [-B originbuf] [-l backlog] [-r] [-K] [-S] [-U] <port>\n",
+            argv[0]);
+    exit(1);
+  }
+
+  //끊긴 클라이언트에 write하다 SIGPIPE로 프록시 전체가 죽지 않도록 무시
+  Server_init();
+  //kill -USR1 <pid> 로 통계 출력
+  Signal(SIGUSR1, sigusr1_handler);
+
+  //스레드를 만들기 전에 rio 백엔드를 바꾼다. 커널이 io_uring을 못 쓰면 read/write 그대로
+  if (use_uring && rio_uring_init() < 0)
+    fprintf(stderr, "io_uring unavailable, using read/write\n");
+
+  //-r이면 이벤트 루프마다 자기 리스닝 소켓, 아니면 모두 같은 소켓 하나
+  listenfds = Malloc(nthreads * sizeof(int));
+  for (i = 0; i < nthreads; i++)
+    listenfds[i] = (reuseport || i == 0) ?
+      Open_listenfd_ex(argv[optind], backlog, reuseport ? LISTEN_REUSEPORT : 0) : listenfds[0];
+  cache_init();
+  pool_init(POOL_MAX_IDLE, POOL_IDLE_TIMEOUT);
+  resolve_init(RESOLVE_NTHREADS);
+
+  //epoll 엔진: 스레드마다 epoll 인스턴스 하나로 모든 소켓을 다중화 (반환하지 않음)
+  if (use_epoll)
+    event_main(listenfds, nthreads);
+
+  //워커 스레드 풀 생성 -> 모두 sbuf에서 connfd가 들어오기를 기다림
+  sbuf_init(&sbuf, nslots);
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, THREAD_STACK); //큰 버퍼는 arena에 있으므로 기본(8MB)보다 작게
+  for (i = 0; i < nthreads; i++)
+    Pthread_create(&tid, &attr, thread, NULL);
+  pthread_attr_destroy(&attr);
+
+  while (1) {
+    clientlen = sizeof(clientaddr);
+    //accept 실패(ECONNABORTED, EMFILE 등)는 그 연결만 버리고 계속 받는다
+    if ((connfd = Accept_e(listenfds[0], (SA *)&clientaddr, &clientlen)) < 0)
+      continue;
+    if (Getnameinfo_e((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0) != 0) {
+      strcpy(hostname, "?");
+      strcpy(port, "?");
+    }
+    printf("Accepted connection from (%s, %s)\n", hostname, port);
+    sbuf_insert(&sbuf, connfd); //큐가 가득 차 있으면 빈 슬롯이 생길 때까지 블록
+  }
+}
+
+//워커 스레드 루틴 - sbuf에서 connfd를 하나씩 꺼내 그 연결의 요청을 모두 처리하고 닫는다.
+void *thread(void *vargp) {
+  arena_t arena; //이 워커가 처리하는 모든 요청이 돌려 가며 쓴다
+
+  Pthread_detach(pthread_self());
+  arena_init(&arena, ARENA_SIZE);
+  while (1) {
+    int connfd = sbuf_remove(&sbuf);
+    serve(connfd, &arena);
+    Close(connfd);
+  }
+  return NULL;
+}
+
+//SIGUSR1 핸들러 - 각 모듈의 카운터를 시그널 안전한 sio 함수로 출력
+void sigusr1_handler(int sig) {
+  int olderrno = errno;
+  resolve_print_stats();
+  cache_print_stats();
+  if (rio_uring_enabled())
+    rio_uring_print_stats();
+  sio_puts("splice: bytes ");
+  sio_putl(__atomic_load_n(&spliced_bytes, __ATOMIC_RELAXED));
+  sio_puts("\n");
+  errno = olderrno;
+}
+
+//serve - 한 클라이언트 연결에서 요청을 차례로 처리한다 (HTTP/1.1 persistent connection)
+//파이프라인으로 미리 도착한 다음 요청은 같은 rio 버퍼에 남아 있다가 다음 doit이 이어서 읽으므로
+//응답은 항상 요청 순서대로 나간다.
+void serve(int fd, arena_t *arena) {
+  struct timeval tv = {KEEPALIVE_TIMEOUT, 0};
+  int one = 1, nreq = 0;
+  rio_t rio;
+
+  //다음 요청을 KEEPALIVE_TIMEOUT초 넘게 기다리지 않는다 -> 유휴 연결이 워커를 계속 붙잡지 않게
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  //헤더와 본문을 따로 쓰므로, 연결을 닫지 않을 때 Nagle 알고리즘이 응답 끝부분을 붙잡지 않게 한다
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  rio_readinitb_sz(&rio, fd, client_bufsize);
+  while (doit(fd, &rio, arena, ++nreq < KEEPALIVE_MAX))
+    ;
+  rio_release(&rio);
+}
+
+//doit() - 한 개의 프록시 트랜잭션 처리
+//클라이언트 요청을 읽어 원 서버(origin)로 전달하고, 받은 응답을 클라이언트에게 돌려준다.
+//네트워크 I/O는 소문자 rio_* 함수를 써서 피어 하나의 오류가 프로세스를 종료시키지 않게 한다.
+//연결을 유지하고 다음 요청을 읽어도 되면 1, 닫아야 하면 0 (more가 0이면 이번이 마지막 요청)
+int doit(int fd, rio_t *rp, arena_t *arena, int more) {
+  int leader = 0, keepalive;
+  cache_obj_t *obj;
+  objbuf_t ob;
+  req_t req;
+  char *buf;
+  size_t n;
+
+  arena_reset(arena); //이전 요청의 문자열과 버퍼를 한 번에 버린다
+  req.arena = arena;
+
+  /* Read request line */
+  buf = arena_alloc(arena, MAXLINE);
+  if (rio_readlineb(rp, buf, MAXLINE) <= 0)
+    return 0; //EOF, 오류, 또는 유휴 시간 초과
+  printf("%s", buf);
+  //각 필드는 요청 라인보다 길 수 없다
+  n = strlen(buf) + 1;
+  req.method = arena_alloc(arena, n);
+  req.uri = arena_alloc(arena, n);
+  req.version = arena_alloc(arena, n);
+  if (sscanf(buf, "%s %s %s", req.method, req.uri, req.version) != 3) {
+    clienterror(fd, buf, "400", "Bad Request",
+                "Proxy couldn't parse the request line");
+    return 0;
+  }
+  if (strcasecmp(req.method, "GET") && strcasecmp(req.method, "HEAD")) {
+    clienterror(fd, req.method, "501", "Not Implemented",
+                "Proxy does not implement this method");
+    return 0;
+  }
+
+  /* Parse URI into hostname, port and path */
+  //각 부분은 URI보다 길 수 없다 ("http://"로 시작해야 하므로 기본 포트 "80"도 들어간다)
+  n = strlen(req.uri) + 1;
+  req.hostname = arena_alloc(arena, n);
+  req.port = arena_alloc(arena, n);
+  req.path = arena_alloc(arena, n);
+  if (parse_uri(req.uri, req.hostname, req.port, req.path) < 0) {
+    clienterror(fd, req.uri, "400", "Bad Request",
+                "Proxy couldn't parse the request URI");
+    return 0;
+  }
+
+  /* Read request headers 캐시 히트여도 다음 요청 전에 헤더를 끝까지 읽어야 한다 */
+  if (read_requesthdrs(rp, &req) < 0)
+    return 0;
+  req.keepalive = req.keepalive && more;
+
+  /* Serve from the cache if we can 캐시 히트면 원 서버에 가지 않고 바로 응답 */
+  //같은 URI를 이미 다른 스레드가 가져오는 중이면 끝날 때까지 기다렸다가 캐시에서 응답
+  objbuf_init(&ob, !strcasecmp(req.method, "GET"));
+  if (ob.ok && (obj = cache_find_or_lead(req.uri, &leader))) {
+    keepalive = send_cached(fd, obj, req.keepalive);
+    cache_release(obj);
+    return keepalive;
+  }
+
+  keepalive = forward(fd, &req, &ob);
+  if (leader)
+    cache_fetch_done(req.uri); //기다리는 follower를 깨운다 (실패했어도)
+  return keepalive;
+}
+
+//forward - 요청을 원 서버로 보내고 응답을 클라이언트에게 전달한다.
+//GET 200 응답은 ob에 모아서 캐시에 넣는다. 클라이언트 연결을 유지해도 되면 1 반환
+int forward(int fd, req_t *req, objbuf_t *ob) {
+  int serverfd, reused, rc, keepalive;
+  ssize_t headlen, hlen;
+  resp_t resp;
+  char *head = arena_alloc(req->arena, HEADSIZE); //클라이언트에게 보낼 응답 헤더
+  rio_t server_rio;
+
+  /* Forward the request and read the response head */
+  //풀에서 꺼낸 연결이 그 사이 서버 쪽에서 닫혔을 수 있다 -> 실패하면 다른 연결로 다시 시도
+  //(GET/HEAD만 처리하므로 다시 보내도 안전)
+  do {
+    if ((serverfd = connect_origin(req->hostname, req->port, &reused)) < 0) {
+      clienterror(fd, req->hostname, "502", "Bad Gateway",
+                  "Proxy couldn't connect to the server");
+      return 0;
+    }
+    rio_readinitb_sz(&server_rio, serverfd, origin_bufsize);
+    if (rio_writen(serverfd, req->rb->buf, req->rb->len) >= 0 &&
+        (headlen = read_responsehdrs(&server_rio, head, &resp,
+                                     !strcasecmp(req->method, "HEAD"))) >= 0)
+      break;
+    rio_release(&server_rio);
+    Close(serverfd);
+    serverfd = -1;
+  } while (reused);
+  if (serverfd < 0) {
+    clienterror(fd, req->hostname, "502", "Bad Gateway",
+                "Proxy couldn't read the server's response");
+    return 0;
+  }
+
+  //클라이언트 연결은 응답의 끝을 알 수 있을 때만 유지한다
+  //(본문 없음, Content-Length, HTTP/1.1 클라이언트에게 chunked) - 연결 종료로 끝나는 응답이면 닫는다
+  keepalive = req->keepalive &&
+              (resp.nobody || resp.length >= 0 || (resp.chunked && req->http11));
+
+  /* Relay the response back to the client 응답을 받는 대로 클라이언트에게 전달 */
+  //전달하면서 ob에도 복사해 두고, MAX_OBJECT_SIZE를 넘으면 캐시는 포기하고 전달만 계속
+  //Content-Length를 알면 복사본을 헤더 + 본문 크기로 미리 할당한다.
+  //MAX_OBJECT_SIZE를 넘으면 처음부터 복사하지 않는다 -> splice로 전달
+  //복사본에는 Connection 헤더를 넣지 않고 히트 때 hdr_len 자리에 끼워 넣는다.
+  //길이를 모르는 응답(chunked / EOF까지)은 본문만 모았다가 끝나면 Content-Length를 붙인 헤더와 합친다
+  //-> 캐시에는 chunk 경계가 들어가지 않고, HTTP/1.0 클라이언트도 히트를 그대로 받을 수 있다.
+  hlen = headlen;
+  if (resp.status != 200)
+    objbuf_free(ob);
+  else if (resp.length >= 0) {
+    objbuf_reserve(ob, headlen + 2 + resp.length);
+    objbuf_append(ob, head, headlen);
+    objbuf_append(ob, "\r\n", 2);
+    ob->hdr_len = headlen;
+  }
+  //chunked는 HTTP/1.1 클라이언트에게만 그대로 전달하고, HTTP/1.0 클라이언트에게는
+  //chunk 경계를 벗겨 본문만 보낸 뒤 연결을 닫는다 (RFC 7230 3.3.1)
+  if (resp.chunked && req->http11)
+    headlen += sprintf(head + headlen, "Transfer-Encoding: chunked\r\n");
+  headlen += sprintf(head + headlen, "Connection: %s\r\n\r\n",
+                     keepalive ? "keep-alive" : "close");
+  rc = send_head(fd, head, headlen, &server_rio, &resp, ob);
+  if (rc == 0)
+    rc = relay_body(&server_rio, fd, &resp, ob, !req->http11);
+
+  //응답 경계까지 정확히 읽었고 남은 바이트가 없으면 다음 요청에 재사용
+  if (rc == 0 && resp.keepalive && server_rio.rio_cnt == 0)
+    pool_put(req->hostname, req->port, serverfd);
+  else
+    Close(serverfd);
+  rio_release(&server_rio);
+
+  //응답을 끝까지 정상적으로 받은 경우에만 저장 (복사본을 그대로 캐시에 넘김)
+  if (rc == 0) {
+    if (resp.length < 0)
+      objbuf_sethead(ob, head, hlen);
+    objbuf_insert(ob, req->uri);
+  }
+  objbuf_free(ob);
+  return rc == 0 && keepalive;
+}
+
+//send_cached - 캐시된 객체를 보낸다. 헤더 끝(hdr_len)에 이번 연결의 Connection 헤더를 끼워 넣는다.
+//연결을 유지해도 되면 1 반환
+//헤더 앞부분 / Connection 줄 / 나머지를 writev 한 번으로 보낸다 (복사 없이, 작은 객체는 한 패킷)
+int send_cached(int fd, cache_obj_t *obj, int keepalive) {
+  char conn[32];
+  struct iovec iov[3];
+
+  if (obj->hdr_len == 0) { //헤더 끝을 모르는 객체 (cache_insert에 hdr_len 0으로 넣은 경우)
+    rio_writen(fd, obj->data, obj->size);
+    return 0;
+  }
+  iov[0].iov_base = obj->data;
+  iov[0].iov_len = obj->hdr_len;
+  iov[1].iov_base = conn;
+  iov[1].iov_len = sprintf(conn, "Connection: %s\r\n", keepalive ? "keep-alive" : "close");
+  iov[2].iov_base = obj->data + obj->hdr_len;
+  iov[2].iov_len = obj->size - obj->hdr_len;
+  if (rio_writev(fd, iov, 3) < 0)
+    return 0;
+  return keepalive;
+}
+
+//send_head - 응답 헤더를, 헤더와 함께 rio 버퍼에 이미 읽혀 있는 본문 앞부분과 같이 writev 한 번으로 보낸다.
+//보낸 본문 바이트는 rio 버퍼와 resp->length에서 뺀다 (chunked는 경계를 찾아야 하므로 헤더만 보냄)
+//성공하면 0, 클라이언트 쪽 오류면 -1
+int send_head(int fd, char *head, size_t len, rio_t *rp, resp_t *resp, objbuf_t *ob) {
+  struct iovec iov[2];
+  size_t n = 0;
+
+  if (!resp->nobody && !resp->chunked && rp->rio_cnt > 0)
+    n = (resp->length >= 0 && resp->length < rp->rio_cnt) ? resp->length : rp->rio_cnt;
+  iov[0].iov_base = head;
+  iov[0].iov_len = len;
+  iov[1].iov_base = rp->rio_bufptr;
+  iov[1].iov_len = n;
+  if (rio_writev(fd, iov, n > 0 ? 2 : 1) < 0)
+    return -1;
+  objbuf_append(ob, rp->rio_bufptr, n);
+  rp->rio_bufptr += n;
+  rp->rio_cnt -= n;
+  if (resp->length >= 0)
+    resp->length -= n;
   return 0;
 }
+
+//connect_origin - 풀에 유휴 연결이 있으면 재사용(*reused = 1), 없으면 캐시된 주소로 새로 연결
+int connect_origin(char *hostname, char *port, int *reused) {
+  int fd;
+
+  if (upstream_keepalive && (fd = pool_get(hostname, port)) >= 0) {
+    *reused = 1;
+    return fd;
+  }
+  *reused = 0;
+  return open_clientfd_cached(hostname, port);
+}
+
+//read_responsehdrs - 원 서버 응답의 상태 라인과 헤더를 읽어 본문 길이 결정 방식(resp)을 알아내고,
+//hop-by-hop 헤더(Connection 등)를 뺀 클라이언트용 헤더를 head에 만든다.
+//Transfer-Encoding: chunked도 빼 둔다 - 호출자가 클라이언트 버전에 따라 다시 붙인다.
+//끝의 빈 줄은 붙이지 않는다 - 호출자가 Connection 헤더와 함께 붙인다 (head 뒤에 HEADROOM 바이트 여유).
+//head의 길이를 반환, 응답이 잘못되었으면 -1
+ssize_t read_responsehdrs(rio_t *rp, char *head, resp_t *resp, int is_head) {
+  char line[MAXLINE];
+  ssize_t n, len, cl_off = 0, cl_len = 0;
+  int minor;
+
+  if ((n = rio_readlineb(rp, line, MAXLINE)) <= 0)
+    return -1;
+  if (sscanf(line, "HTTP/1.%d %d", &minor, &resp->status) != 2)
+    return -1;
+  resp->keepalive = (minor >= 1); //HTTP/1.1은 기본이 keep-alive, 1.0은 기본이 close
+  resp->chunked = 0;
+  resp->length = -1;
+  memcpy(head, line, n);
+  len = n;
+
+  while (1) {
+    if ((n = rio_readlineb(rp, line, MAXLINE)) <= 0)
+      return -1;
+    if (!strcmp(line, "\r\n") || !strcmp(line, "\n"))
+      break;
+    if (!strncasecmp(line, "Connection:", 11)) {
+      if (has_token(line + 11, "close"))
+        resp->keepalive = 0;
+      else if (has_token(line + 11, "keep-alive"))
+        resp->keepalive = 1;
+      continue;
+    }
+    if (!strncasecmp(line, "Keep-Alive:", 11) ||
+        !strncasecmp(line, "Proxy-Connection:", 17))
+      continue;
+    if (!strncasecmp(line, "Transfer-Encoding:", 18) &&
+        has_token(line + 18, "chunked")) {
+      resp->chunked = 1;
+      continue;
+    }
+    if (!strncasecmp(line, "Content-Length:", 15)) {
+      resp->length = strtol(line + 15, NULL, 10);
+      cl_off = len;
+      cl_len = n;
+    }
+    if (len + n + HEADROOM > HEADSIZE)
+      return -1;
+    memcpy(head + len, line, n);
+    len += n;
+  }
+
+  //chunked가 Content-Length보다 우선한다 - 전달하기 전에 Content-Length를 지운다 (RFC 7230 3.3.3)
+  if (resp->chunked && resp->length >= 0) {
+    memmove(head + cl_off, head + cl_off + cl_len, len - cl_off - cl_len);
+    len -= cl_len;
+    resp->length = -1;
+  }
+
+  //본문이 없는 응답: HEAD 요청, 1xx, 204, 304
+  resp->nobody = is_head || resp->status / 100 == 1 ||
+                 resp->status == 204 || resp->status == 304;
+  //길이 정보가 없으면 서버가 연결을 닫아야 본문이 끝난다 -> 재사용 불가
+  if (!resp->nobody && !resp->chunked && resp->length < 0)
+    resp->keepalive = 0;
+
+  return len;
+}
+
+//relay_body - resp가 알려 주는 경계(Content-Length / chunked / EOF)까지 본문을 전달
+//캐시 복사본(ob)에는 본문 데이터만 모은다. dechunk면 클라이언트에게도 chunk 경계 없이 데이터만 보낸다
+//응답 끝까지 정상적으로 전달했으면 0, 원 서버나 클라이언트 쪽 오류면 -1
+int relay_body(rio_t *rp, int fd, resp_t *resp, objbuf_t *ob, int dechunk) {
+  char buf[MAXBUF];
+  ssize_t n;
+  long left;
+  int rc;
+
+  if (resp->nobody)
+    return 0;
+
+  if (resp->chunked) {
+    //chunk 크기 줄 -> 데이터 + CRLF를 크기 0인 마지막 chunk까지 반복, 그 뒤 trailer와 빈 줄
+    while (1) {
+      if ((n = rio_readlineb(rp, buf, MAXLINE)) <= 0 ||
+          (!dechunk && rio_writen(fd, buf, n) < 0))
+        return -1;
+      if ((left = strtol(buf, NULL, 16)) <= 0)
+        break;
+      for (; left > 0; left -= n)
+        if ((n = rio_readnb(rp, buf, left < MAXBUF ? left : MAXBUF)) <= 0 ||
+            send_client(fd, buf, n, ob) < 0)
+          return -1;
+      if ((n = rio_readlineb(rp, buf, MAXLINE)) <= 0 || //데이터 뒤의 CRLF
+          (!dechunk && rio_writen(fd, buf, n) < 0))
+        return -1;
+    }
+    do {
+      if ((n = rio_readlineb(rp, buf, MAXLINE)) <= 0 ||
+          (!dechunk && rio_writen(fd, buf, n) < 0))
+        return -1;
+    } while (strcmp(buf, "\r\n") && strcmp(buf, "\n"));
+    return 0;
+  }
+
+  //캐시하지 않는 본문은 splice로 전달 (chunked는 경계를 찾아야 하므로 항상 복사)
+  left = resp->length;
+  if (!ob->ok && use_splice && (rc = splice_body(rp, fd, &left)) <= 0)
+    return rc;
+
+  if (resp->length >= 0) {
+    for (; left > 0; left -= n)
+      if ((n = rio_readnb(rp, buf, left < MAXBUF ? left : MAXBUF)) <= 0 ||
+          send_client(fd, buf, n, ob) < 0)
+        return -1;
+    return 0;
+  }
+
+  while ((n = rio_readnb(rp, buf, MAXBUF)) > 0)
+    if (send_client(fd, buf, n, ob) < 0)
+      return -1;
+  return n < 0 ? -1 : 0;
+}
+
+//splice_body - rio 버퍼에 이미 읽혀 있는 바이트를 먼저 보내고, 나머지 본문(*left 바이트, -1이면 EOF까지)은
+//splice_relay로 커널 안에서 옮긴다. 성공하면 0, 오류면 -1,
+//소켓이 splice를 지원하지 않으면 1을 반환 -> *left만큼 남은 본문을 호출자가 복사로 전달
+int splice_body(rio_t *rp, int fd, long *left) {
+  ssize_t n;
+
+  if (rp->rio_cnt > 0) {
+    n = (*left >= 0 && *left < rp->rio_cnt) ? *left : rp->rio_cnt;
+    if (rio_writen(fd, rp->rio_bufptr, n) < 0)
+      return -1;
+    rp->rio_bufptr += n;
+    rp->rio_cnt -= n;
+    if (*left >= 0)
+      *left -= n;
+  }
+  if (*left == 0)
+    return 0;
+
+  //io_uring 백엔드가 아직 보내지 않은 응답 헤드가 splice한 본문보다 먼저 나가도록
+  if (rio_flush(fd) < 0)
+    return -1;
+  if ((n = splice_relay(rp->rio_fd, fd, *left)) == SPLICE_UNSUPPORTED)
+    return 1;
+  if (n < 0)
+    return -1;
+  __atomic_fetch_add(&spliced_bytes, n, __ATOMIC_RELAXED);
+  return (*left >= 0 && n != *left) ? -1 : 0; //Content-Length보다 먼저 EOF
+}
+
+//send_client - 클라이언트에게 쓰고 캐시용 복사본(ob)에도 붙인다. 너무 커지면 복사만 포기
+int send_client(int fd, char *buf, size_t n, objbuf_t *ob) {
+  if (rio_writen(fd, buf, n) < 0)
+    return -1; //클라이언트가 연결을 끊은 경우 - 이 트랜잭션만 포기
+  objbuf_append(ob, buf, n);
+  return 0;
+}
+
+//objbuf_init - 캐시용 복사본을 빈 상태로 시작 (버퍼는 처음 붙일 때 할당)
+void objbuf_init(objbuf_t *ob, int ok) {
+  ob->buf = NULL;
+  ob->len = ob->cap = ob->hdr_len = 0;
+  ob->ok = ok;
+}
+
+//objbuf_reserve - 복사본 버퍼를 size 바이트 이상으로 늘린다. MAX_OBJECT_SIZE를 넘으면 복사를 포기
+void objbuf_reserve(objbuf_t *ob, size_t size) {
+  if (!ob->ok || size <= ob->cap)
+    return;
+  if (size > MAX_OBJECT_SIZE) {
+    objbuf_free(ob);
+    return;
+  }
+  ob->buf = Realloc(ob->buf, size);
+  ob->cap = size;
+}
+
+//objbuf_append - 복사본 뒤에 붙인다. 모자라면 두 배씩(MAXBUF부터, MAX_OBJECT_SIZE까지) 늘린다
+void objbuf_append(objbuf_t *ob, const char *data, size_t n) {
+  size_t cap;
+
+  if (!ob->ok)
+    return;
+  if (ob->len + n > MAX_OBJECT_SIZE) {
+    objbuf_free(ob);
+    return;
+  }
+  if (ob->len + n > ob->cap) {
+    for (cap = ob->cap ? ob->cap : MAXBUF; cap < ob->len + n; cap *= 2)
+      ;
+    objbuf_reserve(ob, cap < MAX_OBJECT_SIZE ? cap : MAX_OBJECT_SIZE);
+  }
+  memcpy(ob->buf + ob->len, data, n);
+  ob->len += n;
+}
+
+//objbuf_sethead - 길이를 모르고 받은 응답의 복사본(본문만 있음) 앞에 head(len 바이트)와
+//모은 본문 크기의 Content-Length, 빈 줄을 붙인다. Connection 헤더는 히트 때 hdr_len 자리에 들어간다
+void objbuf_sethead(objbuf_t *ob, const char *head, size_t len) {
+  char cl[32], *buf;
+  size_t n, size;
+
+  if (!ob->ok)
+    return;
+  n = sprintf(cl, "Content-Length: %zu\r\n", ob->len);
+  size = len + n + 2 + ob->len;
+  if (size > MAX_OBJECT_SIZE) {
+    objbuf_free(ob);
+    return;
+  }
+  buf = Malloc(size);
+  memcpy(buf, head, len);
+  memcpy(buf + len, cl, n);
+  memcpy(buf + len + n, "\r\n", 2);
+  if (ob->len)
+    memcpy(buf + len + n + 2, ob->buf, ob->len);
+  Free(ob->buf);
+  ob->buf = buf;
+  ob->len = ob->cap = size;
+  ob->hdr_len = len + n;
+}
+
+//objbuf_insert - 완성된 복사본을 복사 없이 캐시에 넘긴다 (늘리면서 생긴 여분은 먼저 줄인다)
+void objbuf_insert(objbuf_t *ob, const char *uri) {
+  if (!ob->ok || ob->len == 0)
+    return;
+  if (ob->len < ob->cap)
+    ob->buf = Realloc(ob->buf, ob->len);
+  cache_insert_owned(uri, ob->buf, ob->len, ob->hdr_len);
+  ob->buf = NULL;
+  objbuf_free(ob);
+}
+
+//objbuf_free - 복사본을 버리고 더 이상 모으지 않는다
+void objbuf_free(objbuf_t *ob) {
+  Free(ob->buf);
+  objbuf_init(ob, 0);
+}
+
+//parse_uri - 절대 URI(http://host[:port][/path])를 hostname, port, path로 분리
+//성공하면 0, 형식이 잘못되었으면 -1 반환
+int parse_uri(char *uri, char *hostname, char *port, char *path) {
+  char *hostp, *portp, *pathp;
+  size_t len;
+
+  if (strncasecmp(uri, "http://", 7))
+    return -1;
+  hostp = uri + 7;
+
+  //path는 host 뒤 첫 번째 '/'부터, 없으면 "/"
+  pathp = strchr(hostp, '/');
+  if (pathp)
+    strcpy(path, pathp);
+  else
+    strcpy(path, "/");
+
+  len = pathp ? (size_t)(pathp - hostp) : strlen(hostp);
+  if (len == 0 || len >= MAXLINE)
+    return -1;
+
+  //host 부분 안에 ':'가 있으면 그 뒤가 포트 번호, 없으면 80
+  portp = memchr(hostp, ':', len);
+  if (portp) {
+    if (portp == hostp || portp + 1 == hostp + len)
+      return -1;
+    memcpy(hostname, hostp, portp - hostp);
+    hostname[portp - hostp] = '\0';
+    memcpy(port, portp + 1, hostp + len - portp - 1);
+    port[hostp + len - portp - 1] = '\0';
+  }
+  else {
+    memcpy(hostname, hostp, len);
+    hostname[len] = '\0';
+    strcpy(port, "80");
+  }
+  return 0;
+}
+
+//read_requesthdrs - 빈 줄까지 요청 헤더를 읽으면서 rewrite.c로 원 서버에 보낼 요청(req->rb)을 만들고,
+//Connection / Proxy-Connection 값으로 클라이언트 연결을 유지할지(req->keepalive) 정한다.
+//HTTP/1.1은 기본이 keep-alive, 1.0은 "keep-alive"를 보낸 경우에만 유지한다.
+//헤더가 끝나기 전에 연결이 끊기거나, 헤더가 요청 버퍼에 다 들어가지 않으면(431 응답) -1
+int read_requesthdrs(rio_t *rp, req_t *req) {
+  char scratch[MAXLINE], *line;
+  ssize_t n;
+
+  //풀을 쓰면 HTTP/1.1 keep-alive로 요청해서 응답 후에도 원 서버 연결이 유지되게 한다
+  req->rb = arena_alloc(req->arena, sizeof(reqbuf_t));
+  rewrite_start(req->rb, req->method, req->path, upstream_keepalive);
+  while (1) {
+    //헤더 줄을 요청 버퍼 끝에 바로 읽어 들인다 -> 남길 헤더는 복사 없이 길이만 늘어난다
+    if (!(line = rewrite_tail(req->rb)))
+      line = scratch;
+    if ((n = rio_readlineb(rp, line, MAXLINE)) <= 0)
+      return -1;
+    if (!strcmp(line, "\r\n") || !strcmp(line, "\n"))
+      break;
+    if (rewrite_header(req->rb, line, n) < 0) {
+      clienterror(rp->rio_fd, "request head", "431", "Request Header Fields Too Large",
+                  "Proxy couldn't fit the request headers");
+      return -1;
+    }
+  }
+  rewrite_finish(req->rb, req->hostname, req->port);
+
+  req->http11 = !strcasecmp(req->version, "HTTP/1.1");
+  req->keepalive = req->rb->conn >= 0 ? req->rb->conn : req->http11;
+  //본문이 딸린 요청은 본문을 건너뛰지 않으므로(원 서버에도 보내지 않음) 응답 후 연결을 닫는다
+  if (req->rb->hasbody)
+    req->keepalive = 0;
+  return 0;
+}
+
+//clienterror - 클라이언트에게 HTML 에러 페이지 전송
+void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg) {
+  char buf[MAXBUF];
+  int n;
+
+  n = errorpage(buf, cause, errnum, shortmsg, longmsg);
+  rio_writen(fd, buf, n);
+}
+
+//errorpage - 에러 응답 전체(헤더 + HTML 본문)를 buf(MAXBUF 이상)에 만들고 길이를 반환
+int errorpage(char *buf, char *cause, char *errnum, char *shortmsg, char *longmsg) {
+  char body[MAXLINE];
+
+  /* Build the HTTP response body */
+  sprintf(body, "<html><title>Proxy Error</title>");
+  sprintf(body + strlen(body), "<body bgcolor=""ffffff"">\r\n");
+  sprintf(body + strlen(body), "%s: %s\r\n", errnum, shortmsg);
+  sprintf(body + strlen(body), "<p>%s: %.512s\r\n", longmsg, cause);
+  sprintf(body + strlen(body), "<hr><em>The Proxy server</em>\r\n");
+
+  /* Print the HTTP response */
+  sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
+  sprintf(buf + strlen(buf), "Content-type: text/html\r\n");
+  sprintf(buf + strlen(buf), "Content-length: %d\r\n\r\n", (int)strlen(body));
+  strcat(buf, body);
+  return strlen(buf);
+}
@@ -0,0 +1,42 @@
+/*
+ * proxy.h - Definitions shared by the proxy engines
+ *
+ * proxy.c (스레드 풀 엔진)와 proxy_event.c (epoll 엔진)가 함께 쓰는
+ * 요청 파싱 / 캐시 복사본 / 에러 페이지 함수들 (요청 헤더 재작성은 rewrite.c).
+ */
+#ifndef __PROXY_H__
+#define __PROXY_H__
+
+#include "csapp.h"
+
+/* Recommended max cache and object sizes */
+#define MAX_CACHE_SIZE 1049000
+#define MAX_OBJECT_SIZE 102400
+
+#define KEEPALIVE_TIMEOUT 5  /* Seconds to wait for a client's (next) request */
+#define KEEPALIVE_MAX 100    /* Requests served on one client connection */
+
+/* Request and response helpers (proxy.c) */
+int parse_uri(char *uri, char *hostname, char *port, char *path);
+int errorpage(char *buf, char *cause, char *errnum, char *shortmsg,
+              char *longmsg);
+
+/* Copy of a response being collected for the cache (proxy.c) */
+typedef struct {
+  char *buf;       /* Grows on demand up to MAX_OBJECT_SIZE */
+  size_t len, cap;
+  size_t hdr_len;  /* Passed to cache_insert_owned */
+  int ok;          /* Still cacheable */
+} objbuf_t;
+
+void objbuf_init(objbuf_t *ob, int ok);
+void objbuf_reserve(objbuf_t *ob, size_t size);
+void objbuf_append(objbuf_t *ob, const char *data, size_t n);
+void objbuf_sethead(objbuf_t *ob, const char *head, size_t len);
+void objbuf_insert(objbuf_t *ob, const char *uri);
+void objbuf_free(objbuf_t *ob);
+
+/* epoll event loop engine (proxy_event.c) */
+void event_main(int *listenfds, int nloops);
+
+#endif /* __PROXY_H__ */
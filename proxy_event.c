@@ -0,0 +1,918 @@
+/*
+ * proxy_event.c - epoll-driven event loop engine for the proxy
+ *
+ * 스레드마다 epoll 인스턴스 하나를 두고, 그 스레드가 맡은 모든 클라이언트 / 원 서버
+ * 소켓을 non-blocking으로 다중화한다. 연결 하나는 상태 기계(conn_t)로 표현되고,
+ * 블록되는 대신 다음 이벤트가 올 때까지 어디까지 진행했는지만 저장해 둔다.
+ *
+ *   ST_READ_REQ -> (ST_RESOLVE) -> ST_CONNECT -> ST_SEND_REQ -> ST_RELAY
+ *
+ * 요청 바이트가 도착하기 전에는 버퍼를 할당하지 않으므로 유휴 연결은 conn_t 하나 만큼만
+ * 메모리를 쓴다. 리스닝 소켓은 모든 루프가 EPOLLEXCLUSIVE로 공유해서 새 연결 하나에
+ * 루프 하나만 깨어난다 (-r이면 루프마다 SO_REUSEPORT 소켓을 따로 가진다).
+ *
+ * -U(io_uring)이면 리스너에 multishot accept를 걸고 epoll에는 링 fd를 등록한다.
+ * 새 연결은 링의 완료 큐에서 꺼내므로 연결마다 accept4를 부르지 않는다.
+ * 커널이 multishot accept를 지원하지 않거나 링의 accept가 계속 실패하면 accept4로 돌아간다.
+ *
+ * 원 서버 이름은 리졸버 캐시(resolve.c)에서 찾고, 없으면 리졸버 스레드에 조회를 맡긴다(ST_RESOLVE).
+ * 끝난 조회는 루프의 완료 목록에 넣고 eventfd로 루프를 깨운다 -> getaddrinfo가 루프를 멈추지 않는다.
+ *
+ * 모든 연결은 루프의 마감 목록 중 하나에 들어 있고, epoll_wait의 timeout을 가장 이른 마감에 맞춘다.
+ *  - 요청 헤드를 기다리는 연결(ST_READ_REQ)은 KEEPALIVE_TIMEOUT초 안에 헤드를 다 보내야 한다
+ *    (유휴 / slow-loris 연결이 fd를 계속 붙잡지 못한다).
+ *  - 그 뒤의 상태(조회, 연결, 요청 전송, 릴레이)는 IO_TIMEOUT초 동안 진척이 없으면 끝낸다.
+ *    응답하지 않는 원 서버는 504, 응답을 읽지 않는 클라이언트는 연결을 닫는다.
+ * 목록마다 시간이 같으므로 뒤에 붙이기만 해도 마감 순서가 유지된다 (진척이 있으면 맨 뒤로).
+ *
+ * 클라이언트 연결은 스레드 엔진과 같은 규칙으로 유지한다 (HTTP/1.1 또는 keep-alive, 본문 없는 요청,
+ * KEEPALIVE_MAX개까지). 원 서버 응답 헤드의 hop-by-hop 헤더를 빼고 Connection 헤더를 붙여 보내며,
+ * 응답 끝을 알 수 있을 때(본문 없음 / Content-Length)만 연결을 유지한다. 응답이 끝나면 ST_READ_REQ로
+ * 돌아가서 head에 남은 바이트(파이프라인된 다음 요청)부터 처리한다. 요청 하나를 처리하는 동안에는
+ * 클라이언트를 읽지 않으므로 응답 순서는 요청 순서와 같다. 원 서버에는 여전히 요청마다 새로 연결한다.
+ *
+ * 캐시는 스레드 엔진과 공유한다. 히트면 pin한 객체에서 바로 쓰고(hdr_len 자리에 Connection 헤더),
+ * 미스면 릴레이하면서 스레드 엔진과 같은 형식(Connection 없는 헤더 + 본문)으로 복사해 둔다.
+ */
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "cache.h"
+#include "resolve.h"
+#include "rewrite.h"
+#include "rio_uring.h"
+#include "proxy.h"
+
+#define MAXEVENTS 256      /* Max events per epoll_wait */
+#define HEADSIZE  MAXLINE  /* Max size of a client request head */
+#define IO_TIMEOUT 30      /* Seconds a request may go without progress */
+#define HEADROOM  32       /* Kept free after a response head for the Connection header */
+
+/* Connection states */
+enum { ST_READ_REQ, ST_RESOLVE, ST_CONNECT, ST_SEND_REQ, ST_RELAY, ST_CLOSED };
+
+/* Deadline lists: request heads (KEEPALIVE_TIMEOUT), everything after (IO_TIMEOUT) */
+enum { T_HEAD, T_IO, NTIMERS };
+
+typedef struct conn conn_t;
+typedef struct loop loop_t;
+
+/* Name lookup handed to the resolver threads; may outlive its connection */
+typedef struct lookup {
+  resolve_req_t rq;          /* First: resolve_req_t * is cast back to lookup_t * */
+  loop_t *lp;
+  conn_t *conn;              /* NULL once the connection has closed */
+  struct lookup *next;       /* Link in the loop's completed list */
+  char names[];              /* host and port strings for rq */
+} lookup_t;
+
+/* One socket registered with epoll; data.ptr points here */
+typedef struct {
+  int fd;
+  int registered;            /* Added to the epoll set? */
+  uint32_t events;           /* Currently registered interest set */
+  conn_t *conn;              /* Owning connection, NULL for the listener */
+} endpoint_t;
+
+struct conn {
+  endpoint_t client, origin;
+  int state;
+  char *head;                /* Bytes read from the client: request head + pipelined rest */
+  size_t headlen;
+  size_t reqlen;             /* Length of the request head being served */
+  int nreq;                  /* Requests started on this connection */
+  int keepalive;             /* Read the next request after this response */
+  int headreq;               /* HEAD request: the response has no body */
+  reqbuf_t *req;             /* Rewritten request for the origin */
+  size_t reqoff;
+  char *buf;                 /* Origin read buffer: response head, then body */
+  size_t buflen;             /* Response head bytes in buf until hdone */
+  int hdone;                 /* Response head parsed and queued */
+  char *rhead;               /* Response head for the client */
+  size_t rheadlen;           /* ... up to its Connection header */
+  long left;                 /* Body bytes still to come, -1 until origin EOF */
+  struct iovec out[3];       /* Pending output to the client */
+  int outi, nout;            /* out[outi..nout) not fully written yet */
+  char connhdr[32];          /* Connection header spliced into a cache hit */
+  int eof;                   /* Nothing more will be queued in out */
+  int complete;              /* ... because the whole response was queued */
+  int ohup;                  /* Origin hung up and left epoll; read it directly */
+  cache_obj_t *hit;          /* Pinned cache object being sent */
+  char *uri;                 /* Cache key of a cacheable miss */
+  objbuf_t ob;               /* Copy of the response for the cache */
+  addrset_t *addrs;          /* Origin addresses from the resolver */
+  lookup_t *lookup;          /* Pending lookup in ST_RESOLVE */
+  int ainext;                /* Index of the next address to try */
+  conn_t *next_dead;         /* Link in the loop's deferred-free list */
+  conn_t *next_ready;        /* Link in the loop's pipelined-request list */
+  int replied;               /* Part of the response has reached the client */
+  unsigned long deadline;    /* Time out at this time (ms) */
+  conn_t *tprev, *tnext;     /* Link in the loop's deadline list */
+  int timed;                 /* On deadline list tlist? */
+  int tlist;
+};
+
+/* Per-thread event loop */
+struct loop {
+  int epfd;
+  int listenfd;
+  int uring;                 /* Accept through io_uring; listen.fd is the ring */
+  endpoint_t listen;
+  endpoint_t resolved;       /* eventfd signalled by resolver threads */
+  lookup_t *ldone;           /* Completed lookups, pushed by resolver threads */
+  sem_t lmutex;              /* Protects ldone */
+  conn_t *dead;              /* Connections closed during this batch */
+  conn_t *ready, *rtail;     /* Connections with a whole pipelined request in head */
+  conn_t *thead[NTIMERS], *ttail[NTIMERS];  /* Earliest deadline first */
+};
+
+static void *loop_thread(void *vargp);
+static void do_accept(loop_t *lp);
+static void handle_client(loop_t *lp, conn_t *c, uint32_t events);
+static void handle_origin(loop_t *lp, conn_t *c, uint32_t events);
+static void read_request(loop_t *lp, conn_t *c);
+static void start_request(loop_t *lp, conn_t *c);
+static void lookup_done(resolve_req_t *rq);
+static void finish_lookups(loop_t *lp);
+static void start_connect(loop_t *lp, conn_t *c);
+static void send_request(loop_t *lp, conn_t *c);
+static void relay_origin(loop_t *lp, conn_t *c);
+static int parse_response(loop_t *lp, conn_t *c);
+static void relay_body(conn_t *c, char *data, size_t n);
+static void finish_response(conn_t *c, int complete);
+static int flush_client(loop_t *lp, conn_t *c);
+static void next_request(loop_t *lp, conn_t *c);
+static void reply_error(loop_t *lp, conn_t *c, char *cause, char *errnum,
+                        char *shortmsg, char *longmsg);
+static void conn_close(loop_t *lp, conn_t *c);
+static void origin_close(conn_t *c);
+static int watch(loop_t *lp, endpoint_t *ep, uint32_t events);
+static void timer_add(loop_t *lp, conn_t *c, int tlist);
+static void timer_del(loop_t *lp, conn_t *c);
+static int timer_expire(loop_t *lp);
+static void conn_timeout(loop_t *lp, conn_t *c);
+static unsigned long now_ms(void);
+
+//event_main - nloops개의 이벤트 루프를 돌린다. 호출한 스레드도 루프 하나를 맡으며 반환하지 않는다.
+//루프 i는 listenfds[i]에서 accept한다 (모두 같은 소켓이거나, 루프마다 SO_REUSEPORT 소켓)
+void event_main(int *listenfds, int nloops) {
+  int i;
+  pthread_t tid;
+  loop_t *lp;
+
+  for (i = 0; i < nloops; i++) {
+    //리스닝 소켓도 non-blocking -> 다른 루프가 먼저 가져간 연결 때문에 accept에서 멈추지 않도록
+    if (fcntl(listenfds[i], F_SETFL, fcntl(listenfds[i], F_GETFL, 0) | O_NONBLOCK) < 0)
+      unix_error("fcntl error");
+    lp = Calloc(1, sizeof(loop_t));
+    if ((lp->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+      unix_error("epoll_create1 error");
+    lp->listenfd = listenfds[i];
+    if ((lp->resolved.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+      unix_error("eventfd error");
+    Sem_init(&lp->lmutex, 0, 1);
+    if (i == nloops - 1)
+      loop_thread(lp);
+    else
+      Pthread_create(&tid, NULL, loop_thread, lp);
+  }
+}
+
+//loop_thread - 이벤트를 기다렸다가 소켓 종류(리스너 / 클라이언트 / 원 서버)에 따라 분배
+static void *loop_thread(void *vargp) {
+  loop_t *lp = vargp;
+  struct epoll_event events[MAXEVENTS];
+  int i, n, timeout;
+  conn_t *c;
+
+  Pthread_detach(pthread_self());
+  //링은 스레드마다 하나라서 리스너 등록은 루프 스레드 안에서 한다
+  if (rio_uring_enabled() &&
+      (lp->listen.fd = uring_accept_arm(lp->listenfd, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    lp->uring = 1;
+  else
+    lp->listen.fd = lp->listenfd;
+  if (watch(lp, &lp->listen, lp->uring ? EPOLLIN : EPOLLIN | EPOLLEXCLUSIVE) < 0 ||
+      watch(lp, &lp->resolved, EPOLLIN) < 0)
+    unix_error("epoll_ctl error");
+  //거는 동안 이미 받은 연결은 링 fd를 깨우지 않는다
+  if (lp->uring)
+    do_accept(lp);
+
+  while (1) {
+    timeout = timer_expire(lp);
+    if ((n = epoll_wait(lp->epfd, events, MAXEVENTS, timeout)) < 0) {
+      if (errno == EINTR)
+        continue;
+      unix_error("epoll_wait error");
+    }
+    for (i = 0; i < n; i++) {
+      endpoint_t *ep = events[i].data.ptr;
+
+      c = ep->conn;
+      if (ep == &lp->resolved)
+        finish_lookups(lp);
+      else if (!c)
+        do_accept(lp);
+      else if (c->state == ST_CLOSED)
+        continue; //같은 배치 안에서 이미 닫힌 연결
+      else if (ep == &c->client)
+        handle_client(lp, c, events[i].events);
+      else
+        handle_origin(lp, c, events[i].events);
+    }
+
+    //파이프라인된 요청은 배치가 끝난 뒤 여기서 시작한다 -> 히트가 이어져도 재귀가 깊어지지 않는다
+    while ((c = lp->ready)) {
+      if (!(lp->ready = c->next_ready))
+        lp->rtail = NULL;
+      if (c->state == ST_READ_REQ)
+        start_request(lp, c);
+    }
+
+    //배치가 끝난 뒤에 해제해야 남은 이벤트가 해제된 conn을 가리키지 않는다
+    while ((c = lp->dead)) {
+      lp->dead = c->next_dead;
+      Free(c);
+    }
+  }
+  return NULL;
+}
+
+//do_accept - 대기 중인 연결을 모두 받아서 클라이언트 읽기 이벤트를 등록
+//링에서 꺼낸 에러는 그 결과 하나뿐이므로 건너뛰고 계속 꺼낸다 (링 fd는 새 완료가 없으면 다시 깨지 않음).
+//링이 accept를 포기하면(EOPNOTSUPP) 리스닝 소켓을 직접 epoll에 걸고 accept4로 바꾼다
+static void do_accept(loop_t *lp) {
+  int connfd, one = 1;
+  conn_t *c;
+
+  while (1) {
+    connfd = lp->uring ? uring_accept_next() :
+      accept4(lp->listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (connfd < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      if (lp->uring && errno == EOPNOTSUPP) {
+        fprintf(stderr, "io_uring accept keeps failing, using accept4\n");
+        epoll_ctl(lp->epfd, EPOLL_CTL_DEL, lp->listen.fd, NULL);
+        lp->uring = 0;
+        lp->listen.fd = lp->listenfd;
+        lp->listen.registered = 0;
+        if (watch(lp, &lp->listen, EPOLLIN | EPOLLEXCLUSIVE) < 0)
+          unix_error("epoll_ctl error");
+        return;
+      }
+      if (errno != ECONNABORTED)
+        fprintf(stderr, "accept error: %s\n", strerror(errno));
+      if (lp->uring)
+        continue;
+      return;
+    }
+    //헤드와 본문을 따로 쓰는 응답 뒤에 다음 요청이 오므로 Nagle이 응답 끝부분을 붙잡지 않게 한다
+    setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c = Calloc(1, sizeof(conn_t));
+    c->client.fd = connfd;
+    c->client.conn = c;
+    c->origin.fd = -1;
+    c->origin.conn = c;
+    c->state = ST_READ_REQ;
+    timer_add(lp, c, T_HEAD);
+    if (watch(lp, &c->client, EPOLLIN) < 0)
+      conn_close(lp, c);
+  }
+}
+
+static void handle_client(loop_t *lp, conn_t *c, uint32_t events) {
+  if (c->state == ST_READ_REQ && (events & EPOLLIN)) {
+    read_request(lp, c);
+    return;
+  }
+  if (events & (EPOLLERR | EPOLLHUP)) {
+    conn_close(lp, c); //응답을 받을 클라이언트가 없으므로 원 서버 연결도 정리
+    return;
+  }
+  if (c->state == ST_RELAY && (events & EPOLLOUT) && flush_client(lp, c) && c->ohup)
+    relay_origin(lp, c);
+}
+
+static void handle_origin(loop_t *lp, conn_t *c, uint32_t events) {
+  int err = 0;
+  socklen_t len = sizeof(err);
+
+  switch (c->state) {
+  case ST_CONNECT:
+    //non-blocking connect 완료 -> SO_ERROR로 성공 여부 확인, 실패하면 다음 주소
+    if (getsockopt(c->origin.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+      origin_close(c);
+      c->ainext++;
+      start_connect(lp, c);
+      return;
+    }
+    Free(c->addrs);
+    c->addrs = NULL;
+    c->state = ST_SEND_REQ;
+    timer_add(lp, c, T_IO);
+    /* Fall through */
+  case ST_SEND_REQ:
+    send_request(lp, c);
+    break;
+  case ST_RELAY:
+    //클라이언트를 기다리느라 원 서버 관심 이벤트가 0이어도 ERR/HUP은 통지되고, level-triggered라
+    //버퍼가 빌 때까지 매 epoll_wait마다 다시 온다 -> epoll에서 빼고, 소켓에 남은 바이트는
+    //버퍼가 빌 때마다 직접 읽어서 EOF(또는 오류)까지 전달한다
+    if ((events & (EPOLLERR | EPOLLHUP)) && c->outi < c->nout) {
+      epoll_ctl(lp->epfd, EPOLL_CTL_DEL, c->origin.fd, NULL);
+      c->origin.registered = 0;
+      c->ohup = 1;
+      return;
+    }
+    relay_origin(lp, c);
+    break;
+  }
+}
+
+//read_request - 요청 헤드("\r\n\r\n"까지)가 모두 도착할 때까지 읽어서 쌓아 둔다.
+static void read_request(loop_t *lp, conn_t *c) {
+  ssize_t n;
+
+  if (!c->head)
+    c->head = Malloc(HEADSIZE + 1);
+  while (c->headlen < HEADSIZE) {
+    n = read(c->client.fd, c->head + c->headlen, HEADSIZE - c->headlen);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return; //나머지는 다음 EPOLLIN에서
+    if (n <= 0) {
+      conn_close(lp, c);
+      return;
+    }
+    c->headlen += n;
+    c->head[c->headlen] = '\0';
+    if (strstr(c->head, "\r\n\r\n")) {
+      start_request(lp, c);
+      return;
+    }
+  }
+  reply_error(lp, c, "request head", "400", "Bad Request",
+              "Request header is too large");
+}
+
+//start_request - 요청 라인과 헤더를 파싱해 원 서버로 보낼 요청을 만들고 연결을 시작한다.
+static void start_request(loop_t *lp, conn_t *c) {
+  char method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+  char hostname[MAXLINE], port[MAXLINE], path[MAXLINE];
+  char *p, *end;
+  int err;
+
+  timer_add(lp, c, T_IO);
+  //응답을 다 보낼 때까지 클라이언트에게서 읽지 않는다 -> 파이프라인된 요청도 순서대로 (ERR/HUP은 계속 통지됨)
+  watch(lp, &c->client, 0);
+
+  c->reqlen = strstr(c->head, "\r\n\r\n") + 4 - c->head; //뒤는 다음 요청의 바이트
+  c->nreq++;
+  end = strstr(c->head, "\r\n");
+  *end = '\0';
+  printf("%s\n", c->head);
+  if (sscanf(c->head, "%s %s %s", method, uri, version) != 3) {
+    reply_error(lp, c, c->head, "400", "Bad Request",
+                "Proxy couldn't parse the request line");
+    return;
+  }
+  if (strcasecmp(method, "GET") && strcasecmp(method, "HEAD")) {
+    reply_error(lp, c, method, "501", "Not Implemented",
+                "Proxy does not implement this method");
+    return;
+  }
+  if (parse_uri(uri, hostname, port, path) < 0) {
+    reply_error(lp, c, uri, "400", "Bad Request",
+                "Proxy couldn't parse the request URI");
+    return;
+  }
+  c->headreq = !strcasecmp(method, "HEAD");
+
+  //원 서버 응답은 본문 길이를 모르면 EOF까지 읽으므로 원 서버에는 항상 Connection: close로 요청
+  //헤더는 스레드 엔진과 같은 규칙(rewrite.c)으로 head 버퍼에서 요청 버퍼로 한 번씩만 복사
+  c->req = Malloc(sizeof(reqbuf_t));
+  rewrite_start(c->req, method, path, 0);
+  for (p = end + 2; strncmp(p, "\r\n", 2); p = end + 2) {
+    end = strstr(p, "\r\n");
+    if (rewrite_header(c->req, p, end + 2 - p) < 0) {
+      reply_error(lp, c, "request head", "431", "Request Header Fields Too Large",
+                  "Proxy couldn't fit the request headers");
+      return;
+    }
+  }
+  rewrite_finish(c->req, hostname, port);
+  //클라이언트 연결 유지는 스레드 엔진의 read_requesthdrs와 같은 규칙
+  //(본문이 딸린 요청은 본문을 건너뛰지 않으므로 응답 후 닫는다)
+  c->keepalive = (c->req->conn >= 0 ? c->req->conn : !strcasecmp(version, "HTTP/1.1")) &&
+                 !c->req->hasbody && c->nreq < KEEPALIVE_MAX;
+
+  //캐시 히트 -> pin한 객체를 그대로 쓰고 헤더 끝(hdr_len)에 이번 연결의 Connection 헤더를 끼워 넣는다
+  if (!c->headreq) {
+    if ((c->hit = cache_find(uri))) {
+      Free(c->req);
+      c->req = NULL;
+      if (c->hit->hdr_len == 0)
+        c->keepalive = 0; //헤더 끝을 모르는 객체 - 그대로 보내고 닫는다
+      c->out[0].iov_base = c->hit->data;
+      c->out[0].iov_len = c->hit->hdr_len;
+      c->out[1].iov_base = c->connhdr;
+      c->out[1].iov_len = c->hit->hdr_len == 0 ? 0 :
+        sprintf(c->connhdr, "Connection: %s\r\n", c->keepalive ? "keep-alive" : "close");
+      c->out[2].iov_base = c->hit->data + c->hit->hdr_len;
+      c->out[2].iov_len = c->hit->size - c->hit->hdr_len;
+      c->nout = 3;
+      c->eof = c->complete = 1;
+      c->state = ST_RELAY;
+      flush_client(lp, c);
+      return;
+    }
+    c->uri = Malloc(strlen(uri) + 1);
+    strcpy(c->uri, uri);
+  }
+
+  /* Get a list of potential origin addresses */
+  //캐시에 없으면 리졸버 스레드에 맡기고 lookup_done -> finish_lookups에서 이어간다
+  c->addrs = Malloc(sizeof(addrset_t));
+  if ((err = resolve_try(hostname, port, c->addrs)) == RESOLVE_MISS) {
+    lookup_t *lk = Malloc(sizeof(lookup_t) + strlen(hostname) + strlen(port) + 2);
+
+    strcpy(lk->names, hostname);
+    strcpy(lk->names + strlen(hostname) + 1, port);
+    lk->rq.host = lk->names;
+    lk->rq.port = lk->names + strlen(hostname) + 1;
+    lk->rq.done = lookup_done;
+    lk->lp = lp;
+    lk->conn = c;
+    c->lookup = lk;
+    c->state = ST_RESOLVE;
+    resolve_async(&lk->rq);
+    return;
+  }
+  if (err) {
+    reply_error(lp, c, hostname, "502", "Bad Gateway",
+                "Proxy couldn't resolve the server");
+    return;
+  }
+  c->ainext = 0;
+  start_connect(lp, c);
+}
+
+//lookup_done - 리졸버 스레드에서 불린다. 완료 목록에 넣고 eventfd로 루프를 깨운다
+static void lookup_done(resolve_req_t *rq) {
+  lookup_t *lk = (lookup_t *)rq;
+  loop_t *lp = lk->lp;
+  uint64_t one = 1;
+
+  P(&lp->lmutex);
+  lk->next = lp->ldone;
+  lp->ldone = lk;
+  V(&lp->lmutex);
+  if (write(lp->resolved.fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    unix_error("eventfd write error");
+}
+
+//finish_lookups - 끝난 조회마다 기다리던 연결을 이어간다 (그 사이 닫힌 연결이면 버리기만)
+static void finish_lookups(loop_t *lp) {
+  lookup_t *lk, *next;
+  conn_t *c;
+  uint64_t n;
+
+  if (read(lp->resolved.fd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+    unix_error("eventfd read error");
+  P(&lp->lmutex);
+  lk = lp->ldone;
+  lp->ldone = NULL;
+  V(&lp->lmutex);
+  for (; lk; lk = next) {
+    next = lk->next;
+    if ((c = lk->conn)) {
+      c->lookup = NULL;
+      if (lk->rq.err)
+        reply_error(lp, c, (char *)lk->rq.host, "502", "Bad Gateway",
+                    "Proxy couldn't resolve the server");
+      else {
+        *c->addrs = lk->rq.set;
+        c->ainext = 0;
+        start_connect(lp, c);
+      }
+    }
+    Free(lk);
+  }
+}
+
+//start_connect - 남은 주소들로 non-blocking connect 시도, 완료는 EPOLLOUT으로 통지된다.
+static void start_connect(loop_t *lp, conn_t *c) {
+  int fd;
+
+  for (; c->ainext < c->addrs->naddrs; c->ainext++) {
+    fd = socket(c->addrs->addrs[c->ainext].family,
+                c->addrs->addrs[c->ainext].socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                c->addrs->addrs[c->ainext].protocol);
+    if (fd < 0)
+      continue;
+    if (connect(fd, (SA *)&c->addrs->addrs[c->ainext].addr,
+                c->addrs->addrs[c->ainext].addrlen) == 0 || errno == EINPROGRESS) {
+      c->origin.fd = fd;
+      c->state = ST_CONNECT;
+      if (watch(lp, &c->origin, EPOLLOUT) < 0)
+        conn_close(lp, c);
+      return;
+    }
+    close(fd);
+  }
+  reply_error(lp, c, "origin", "502", "Bad Gateway",
+              "Proxy couldn't connect to the server");
+}
+
+//send_request - 원 서버에 요청을 보낸다. 소켓 버퍼가 차면 다음 EPOLLOUT에서 이어서
+static void send_request(loop_t *lp, conn_t *c) {
+  ssize_t n;
+
+  while (c->reqoff < c->req->len) {
+    n = write(c->origin.fd, c->req->buf + c->reqoff, c->req->len - c->reqoff);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+    if (n < 0) {
+      reply_error(lp, c, "origin", "502", "Bad Gateway",
+                  "Proxy couldn't send the request");
+      return;
+    }
+    c->reqoff += n;
+    timer_add(lp, c, T_IO);
+  }
+  Free(c->req);
+  c->req = NULL;
+  c->buf = Malloc(MAXBUF + 1);
+  objbuf_init(&c->ob, c->uri != NULL);
+  c->state = ST_RELAY;
+  if (watch(lp, &c->origin, EPOLLIN) < 0)
+    conn_close(lp, c);
+}
+
+//relay_origin - 클라이언트에 보낼 것이 없을 때만 원 서버를 읽는다 -> 느린 클라이언트가 메모리를 쌓지 않는다.
+//응답 헤드는 끝날 때까지 buf에 모았다가 parse_response로 넘기고, 그 뒤로는 읽은 만큼 본문으로 보낸다.
+//원 서버가 끊겨 epoll에서 빠졌으면(ohup) 클라이언트가 받아 주는 동안 EOF까지 계속 읽는다
+static void relay_origin(loop_t *lp, conn_t *c) {
+  ssize_t n;
+
+  do {
+    if (c->outi < c->nout)
+      return;
+    n = read(c->origin.fd, c->buf + c->buflen, MAXBUF - c->buflen);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) && !c->ohup)
+      return;
+    if (n <= 0) {
+      if (!c->hdone) {
+        reply_error(lp, c, "origin", "502", "Bad Gateway",
+                    "Proxy couldn't read the server's response");
+        return;
+      }
+      //길이를 모르는 본문은 원 서버의 EOF가 끝이다. 오류나 모자란 Content-Length면 잘린 응답
+      finish_response(c, n == 0 && !c->ohup && c->left < 0);
+    }
+    else {
+      timer_add(lp, c, T_IO);
+      if (c->hdone)
+        relay_body(c, c->buf, n);
+      else {
+        c->buflen += n;
+        if (parse_response(lp, c) <= 0)
+          return;
+      }
+    }
+  } while (flush_client(lp, c) && c->ohup);
+}
+
+//parse_response - buf에 응답 헤드가 다 모였으면 클라이언트용 헤드를 만들어 out에 넣는다.
+//스레드 엔진의 read_responsehdrs처럼 hop-by-hop 헤더를 빼고 본문 길이(left)를 정한다.
+//본문 끝을 알 수 없으면(원 서버 EOF까지) 클라이언트 연결도 닫아야 끝을 알릴 수 있다.
+//헤드를 넣었으면 1, 더 읽어야 하면 0, 에러 응답을 보냈으면 -1
+static int parse_response(loop_t *lp, conn_t *c) {
+  char *p, *end, *hend, save;
+  int minor, status, chunked = 0;
+  long length = -1;
+
+  c->buf[c->buflen] = '\0';
+  if (!(hend = strstr(c->buf, "\r\n\r\n"))) {
+    if (c->buflen < MAXBUF)
+      return 0;
+    reply_error(lp, c, "origin", "502", "Bad Gateway",
+                "The server's response head is too large");
+    return -1;
+  }
+  if (sscanf(c->buf, "HTTP/1.%d %d", &minor, &status) != 2) {
+    reply_error(lp, c, "origin", "502", "Bad Gateway",
+                "Proxy couldn't parse the server's response");
+    return -1;
+  }
+
+  //상태 라인과 남길 헤더를 rhead에 복사 (끝의 빈 줄은 Connection 헤더와 함께 붙인다)
+  hend += 2;
+  c->rhead = Malloc(hend - c->buf + HEADROOM);
+  c->rheadlen = 0;
+  for (p = c->buf; p < hend; p = end) {
+    end = strstr(p, "\r\n") + 2;
+    if (p != c->buf) {
+      if (!strncasecmp(p, "Connection:", 11) || !strncasecmp(p, "Keep-Alive:", 11) ||
+          !strncasecmp(p, "Proxy-Connection:", 17))
+        continue;
+      if (!strncasecmp(p, "Transfer-Encoding:", 18)) {
+        save = *end; //has_token은 줄 끝까지만 봐야 한다
+        *end = '\0';
+        chunked = has_token(p + 18, "chunked");
+        *end = save;
+      }
+      if (!strncasecmp(p, "Content-Length:", 15))
+        length = strtol(p + 15, NULL, 10);
+    }
+    memcpy(c->rhead + c->rheadlen, p, end - p);
+    c->rheadlen += end - p;
+  }
+
+  //본문이 없는 응답: HEAD 요청, 1xx, 204, 304. chunked가 Content-Length보다 우선한다
+  if (c->headreq || status / 100 == 1 || status == 204 || status == 304)
+    c->left = 0;
+  else
+    c->left = chunked ? -1 : length;
+  if (c->left < 0)
+    c->keepalive = 0;
+
+  //캐시 복사본은 200만. 길이를 알면 헤더 + 빈 줄 + 본문 크기로 미리 할당하고,
+  //모르면 본문만 모았다가 finish_response에서 Content-Length를 붙인 헤더와 합친다
+  if (status != 200)
+    objbuf_free(&c->ob);
+  else if (c->left >= 0) {
+    objbuf_reserve(&c->ob, c->rheadlen + 2 + c->left);
+    objbuf_append(&c->ob, c->rhead, c->rheadlen);
+    objbuf_append(&c->ob, "\r\n", 2);
+    c->ob.hdr_len = c->rheadlen;
+  }
+
+  c->out[0].iov_base = c->rhead;
+  c->out[0].iov_len = c->rheadlen + sprintf(c->rhead + c->rheadlen, "Connection: %s\r\n\r\n",
+                                            c->keepalive ? "keep-alive" : "close");
+  c->outi = 0;
+  c->nout = 1;
+  c->hdone = 1;
+  hend += 2;
+  p = c->buf + c->buflen;
+  c->buflen = 0; //이제부터 buf는 본문을 읽는 데만 쓴다
+  if (c->left == 0)
+    finish_response(c, 1);
+  else if (p > hend)
+    relay_body(c, hend, p - hend); //헤드와 같이 읽힌 본문 앞부분
+  return 1;
+}
+
+//relay_body - 본문 n바이트를 out에 넣고 캐시 복사본에 붙인다.
+//Content-Length를 넘는 바이트는 버리고, 다 받았으면 원 서버의 EOF를 기다리지 않고 응답을 끝낸다
+static void relay_body(conn_t *c, char *data, size_t n) {
+  if (c->left >= 0 && n > (size_t)c->left)
+    n = c->left;
+  c->out[c->nout].iov_base = data;
+  c->out[c->nout].iov_len = n;
+  c->nout++;
+  objbuf_append(&c->ob, data, n); //너무 커지면 복사만 포기하고 전달은 계속
+  if (c->left >= 0 && (c->left -= n) == 0)
+    finish_response(c, 1);
+}
+
+//finish_response - 원 서버에서 더 받을 것이 없다. 응답을 끝까지 받았으면(complete) 캐시에 넣는다
+static void finish_response(conn_t *c, int complete) {
+  c->eof = 1;
+  c->complete = complete;
+  if (complete) {
+    if (c->left < 0)
+      objbuf_sethead(&c->ob, c->rhead, c->rheadlen);
+    objbuf_insert(&c->ob, c->uri);
+  }
+  objbuf_free(&c->ob);
+  origin_close(c);
+}
+
+//flush_client - out을 클라이언트에 쓴다. 다 못 쓰면 원 서버 읽기를 멈추고 클라이언트 EPOLLOUT을 기다린다.
+//응답을 다 보냈으면 연결을 유지할 때 next_request, 아니면 닫는다.
+//out을 다 비우고 응답이 아직 남았으면 1, 기다리거나 응답이 끝났으면 0
+static int flush_client(loop_t *lp, conn_t *c) {
+  ssize_t n;
+
+  while (c->outi < c->nout) {
+    n = writev(c->client.fd, c->out + c->outi, c->nout - c->outi);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (watch(lp, &c->client, EPOLLOUT) < 0 ||
+          (c->origin.registered && watch(lp, &c->origin, 0) < 0))
+        conn_close(lp, c);
+      return 0;
+    }
+    if (n < 0) {
+      conn_close(lp, c); //클라이언트가 끊김
+      return 0;
+    }
+    c->replied = 1;
+    timer_add(lp, c, T_IO);
+    //다 쓴 항목은 건너뛰고, 일부만 쓴 항목은 남은 부분을 가리키게 한다
+    for (; c->outi < c->nout && (size_t)n >= c->out[c->outi].iov_len; c->outi++)
+      n -= c->out[c->outi].iov_len;
+    if (n > 0) {
+      c->out[c->outi].iov_base = (char *)c->out[c->outi].iov_base + n;
+      c->out[c->outi].iov_len -= n;
+    }
+  }
+  c->outi = c->nout = 0;
+
+  if (c->eof) {
+    if (c->keepalive && c->complete)
+      next_request(lp, c);
+    else
+      conn_close(lp, c);
+    return 0;
+  }
+  if (watch(lp, &c->client, 0) < 0 || (!c->ohup && watch(lp, &c->origin, EPOLLIN) < 0)) {
+    conn_close(lp, c);
+    return 0;
+  }
+  return 1;
+}
+
+//next_request - 응답을 다 보냈다. 요청마다 쓴 버퍼를 놓고 ST_READ_REQ로 돌아가 head에 남은 바이트부터 읽는다.
+//다음 요청 헤드가 이미 다 와 있으면 loop_thread가 배치 끝에 시작하도록 ready 목록에 넣는다
+static void next_request(loop_t *lp, conn_t *c) {
+  if (c->hit) {
+    cache_release(c->hit);
+    c->hit = NULL;
+  }
+  Free(c->buf);
+  Free(c->rhead);
+  Free(c->uri);
+  c->buf = c->rhead = c->uri = NULL;
+  objbuf_free(&c->ob);
+  c->buflen = c->rheadlen = c->reqoff = 0;
+  c->hdone = c->eof = c->complete = c->ohup = c->replied = 0;
+
+  c->headlen -= c->reqlen;
+  memmove(c->head, c->head + c->reqlen, c->headlen);
+  c->reqlen = 0;
+  c->state = ST_READ_REQ;
+  timer_add(lp, c, T_HEAD);
+  if (c->headlen == 0) {
+    Free(c->head); //유휴 keep-alive 연결은 conn_t 만큼만 메모리를 쓴다
+    c->head = NULL;
+  }
+  else {
+    c->head[c->headlen] = '\0';
+    if (strstr(c->head, "\r\n\r\n")) {
+      c->next_ready = NULL;
+      if (lp->rtail)
+        lp->rtail->next_ready = c;
+      else
+        lp->ready = c;
+      lp->rtail = c;
+      return;
+    }
+  }
+  if (watch(lp, &c->client, EPOLLIN) < 0)
+    conn_close(lp, c);
+}
+
+//reply_error - 에러 페이지를 릴레이 버퍼에 넣고 다 보낸 뒤 연결을 닫는다.
+static void reply_error(loop_t *lp, conn_t *c, char *cause, char *errnum,
+                        char *shortmsg, char *longmsg) {
+  timer_add(lp, c, T_IO); //읽지 않는 클라이언트도 IO_TIMEOUT 뒤에는 닫는다
+  if (!c->buf)
+    c->buf = Malloc(MAXBUF + 1);
+  c->out[0].iov_base = c->buf;
+  c->out[0].iov_len = errorpage(c->buf, cause, errnum, shortmsg, longmsg);
+  c->outi = 0;
+  c->nout = 1;
+  c->eof = 1;
+  c->keepalive = 0;
+  c->state = ST_RELAY;
+  origin_close(c);
+  if (c->lookup) { //ST_RESOLVE에서 시간이 다 됨 -> 끝난 조회가 연결을 이어가지 않게
+    c->lookup->conn = NULL;
+    c->lookup = NULL;
+  }
+  flush_client(lp, c);
+}
+
+//origin_close - 원 서버 소켓을 닫는다. 닫힌 fd는 epoll 집합에서도 자동으로 빠진다
+static void origin_close(conn_t *c) {
+  if (c->origin.fd < 0)
+    return;
+  close(c->origin.fd);
+  c->origin.fd = -1;
+  c->origin.registered = 0;
+}
+
+//conn_close - 소켓을 닫고(epoll에서도 자동 제거) 버퍼를 해제, conn_t는 배치가 끝난 뒤 해제
+static void conn_close(loop_t *lp, conn_t *c) {
+  timer_del(lp, c);
+  if (c->lookup)
+    c->lookup->conn = NULL; //조회가 끝나면 finish_lookups가 lookup만 해제한다
+  if (c->client.fd >= 0)
+    close(c->client.fd);
+  if (c->origin.fd >= 0)
+    close(c->origin.fd);
+  Free(c->addrs);
+  if (c->hit)
+    cache_release(c->hit);
+  Free(c->head);
+  Free(c->req);
+  Free(c->buf);
+  Free(c->rhead);
+  Free(c->uri);
+  objbuf_free(&c->ob);
+  c->state = ST_CLOSED;
+  c->next_dead = lp->dead;
+  lp->dead = c;
+}
+
+//watch - endpoint의 관심 이벤트를 events로 바꾼다. 처음이면 ADD, 같으면 아무것도 하지 않음
+static int watch(loop_t *lp, endpoint_t *ep, uint32_t events) {
+  struct epoll_event ev;
+  int op;
+
+  if (ep->registered && ep->events == events)
+    return 0;
+  op = ep->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  ev.events = events;
+  ev.data.ptr = ep;
+  if (epoll_ctl(lp->epfd, op, ep->fd, &ev) < 0)
+    return -1;
+  ep->registered = 1;
+  ep->events = events;
+  return 0;
+}
+
+//timer_add - 연결을 tlist 마감 목록 끝으로 옮긴다. 목록 안의 시간이 모두 같으므로 넣은 순서가 곧 마감 순서
+static void timer_add(loop_t *lp, conn_t *c, int tlist) {
+  static const unsigned long timeout_ms[NTIMERS] = {
+    KEEPALIVE_TIMEOUT * 1000UL, IO_TIMEOUT * 1000UL
+  };
+
+  timer_del(lp, c);
+  c->deadline = now_ms() + timeout_ms[tlist];
+  c->tlist = tlist;
+  c->tnext = NULL;
+  c->tprev = lp->ttail[tlist];
+  if (lp->ttail[tlist])
+    lp->ttail[tlist]->tnext = c;
+  else
+    lp->thead[tlist] = c;
+  lp->ttail[tlist] = c;
+  c->timed = 1;
+}
+
+//timer_del - 마감 목록에서 뺀다 (목록에 없으면 아무것도 하지 않음)
+static void timer_del(loop_t *lp, conn_t *c) {
+  if (!c->timed)
+    return;
+  if (c->tprev)
+    c->tprev->tnext = c->tnext;
+  else
+    lp->thead[c->tlist] = c->tnext;
+  if (c->tnext)
+    c->tnext->tprev = c->tprev;
+  else
+    lp->ttail[c->tlist] = c->tprev;
+  c->timed = 0;
+}
+
+//timer_expire - 마감이 지난 연결을 끝내고, 다음 마감까지 남은 시간(ms)을 반환. 목록이 모두 비었으면 -1
+//닫은 연결은 lp->dead에 들어가므로 다음 배치가 끝날 때 해제된다
+static int timer_expire(loop_t *lp) {
+  unsigned long now = now_ms();
+  int i, next = -1;
+  conn_t *c;
+
+  for (i = 0; i < NTIMERS; i++) {
+    while ((c = lp->thead[i]) && c->deadline <= now)
+      conn_timeout(lp, c); //c를 목록에서 빼거나 맨 뒤로 옮긴다
+    if (c && (next < 0 || (int)(c->deadline - now) < next))
+      next = c->deadline - now;
+  }
+  return next;
+}
+
+//conn_timeout - 아직 클라이언트에 아무것도 보내지 않았으면 504, 헤드를 기다리던 중이거나 응답을 보내던 중이면 닫는다
+static void conn_timeout(loop_t *lp, conn_t *c) {
+  if (c->state == ST_READ_REQ || c->eof || c->replied)
+    conn_close(lp, c);
+  else
+    reply_error(lp, c, "origin", "504", "Gateway Timeout",
+                "The server didn't respond in time");
+}
+
+/* Coarse monotonic clock, read through the vDSO */
+static unsigned long now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
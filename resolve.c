@@ -0,0 +1,366 @@
+/*
+ * resolve.c - Shared hostname -> address cache in front of getaddrinfo
+ *
+ * open_clientfd는 연결할 때마다 getaddrinfo를 호출해서 glibc 리졸버 안에서
+ * 워커 스레드가 블록된다. 여기서는 "host:port"별로 결과를 복사해 두고 TTL 동안 재사용한다.
+ *  - 성공한 결과는 RESOLVE_TTL초, 실패한 결과(negative entry)는 RESOLVE_NEG_TTL초 동안 유지
+ *  - 만료 RESOLVE_REFRESH초 전부터 조회되면 백그라운드 리졸버 스레드에 갱신을 맡기므로
+ *    자주 쓰는 이름은 요청 스레드가 getaddrinfo를 기다리는 일이 없다.
+ *    실패한 결과와 갱신에 실패한 엔트리는 미리 갱신하지 않는다 -> 없는 이름을 계속
+ *    물어도 getaddrinfo는 RESOLVE_NEG_TTL초에 한 번만 돈다.
+ *  - 블록되면 안 되는 호출자(이벤트 루프)는 resolve_try로 캐시만 보고, 미스면 resolve_async로
+ *    리졸버 스레드에 조회를 맡긴 뒤 완료 콜백을 받는다.
+ *  - 테이블이 MAXENTRIES개로 차면 만료된 엔트리를 지우고 자리를 만든다 (1초에 한 번까지).
+ *  - 히트 수 x 평균 미스 지연으로 절약한 해석 시간을 센다 (resolve_print_stats).
+ */
+#include "resolve.h"
+
+#define NBUCKETS   256   /* Hash buckets (power of 2) */
+#define MAXENTRIES 4096  /* Names cached at most; beyond this we just resolve */
+#define QSIZE      64    /* Pending refresh requests */
+#define RESOLVE_REFRESH 10  /* Refresh this many seconds before expiry */
+
+typedef struct entry {
+    char *host, *port;
+    addrset_t set;            /* Valid if err == 0 */
+    int err;                  /* getaddrinfo error code, 0 on success */
+    time_t expires;
+    int refreshing;           /* Queued for the resolver threads */
+    int refresh_failed;       /* Last refresh failed; wait for expiry */
+    struct entry *next;
+} entry_t;
+
+static entry_t *buckets[NBUCKETS];
+static int nentries;
+static time_t last_sweep;     /* When expired entries were last freed */
+static sem_t mutex;           /* Protects the table and entries */
+
+/* Refresh queue: bounded FIFO of entries, in the style of sbuf */
+static entry_t *queue[QSIZE];
+static int qfront, qrear, qcount;
+static sem_t qmutex, qitems;  /* qitems counts refreshes and async lookups */
+
+/* Async lookups: unbounded FIFO, each caller waits for at most one */
+typedef struct ajob {
+    resolve_req_t *rq;
+    struct ajob *next;
+} ajob_t;
+static ajob_t *ahead, *atail;
+
+/* Counters */
+static unsigned long nhits, nmisses;
+static unsigned long miss_ns;  /* Total time spent in foreground lookups */
+
+static entry_t *find(const char *host, const char *port);
+static void store(const char *host, const char *port, int err, addrset_t *set);
+static void sweep(time_t now);
+static unsigned hash(const char *host, const char *port);
+static int lookup(const char *host, const char *port, addrset_t *set);
+static void *resolver_thread(void *vargp);
+static long elapsed_ns(struct timespec *start);
+
+void resolve_init(int nthreads)
+{
+    pthread_t tid;
+    int i;
+
+    Sem_init(&mutex, 0, 1);
+    Sem_init(&qmutex, 0, 1);
+    Sem_init(&qitems, 0, 0);
+    for (i = 0; i < nthreads; i++)
+        Pthread_create(&tid, NULL, resolver_thread, NULL);
+}
+
+//resolve - host:port의 주소 목록을 set에 복사. 성공하면 0, 실패하면 getaddrinfo 오류 코드
+int resolve(const char *host, const char *port, addrset_t *set)
+{
+    struct timespec start;
+    int err;
+
+    if ((err = resolve_try(host, port, set)) != RESOLVE_MISS)
+        return err;
+
+    /* Slow path: resolve in this thread and remember the answer */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    err = lookup(host, port, set);
+    P(&mutex);
+    nmisses++;
+    miss_ns += elapsed_ns(&start);
+    store(host, port, err, set);
+    V(&mutex);
+    return err;
+}
+
+//resolve_try - resolve와 같지만 캐시에 없으면 getaddrinfo 대신 RESOLVE_MISS를 반환 (블록되지 않음)
+int resolve_try(const char *host, const char *port, addrset_t *set)
+{
+    entry_t *ep;
+    time_t now = time(NULL);
+    int err;
+
+    P(&mutex);
+    if (!(ep = find(host, port)) || now >= ep->expires) {
+        V(&mutex);
+        return RESOLVE_MISS;
+    }
+    err = ep->err;
+    if (!err)
+        *set = ep->set;
+    //곧 만료될 엔트리는 리졸버 스레드가 미리 갱신 (큐가 꽉 찼으면 다음 조회 때 다시 시도)
+    //실패한 결과는 만료될 때까지 그대로 둔다 - 갱신해도 다시 실패할 이름에 getaddrinfo를 돌리지 않게
+    if (!ep->refreshing && !ep->err && !ep->refresh_failed &&
+        ep->expires - now <= RESOLVE_REFRESH) {
+        P(&qmutex);
+        if (qcount < QSIZE) {
+            ep->refreshing = 1;
+            queue[qrear] = ep;
+            qrear = (qrear + 1) % QSIZE;
+            qcount++;
+            V(&qitems);
+        }
+        V(&qmutex);
+    }
+    nhits++;
+    V(&mutex);
+    return err;
+}
+
+/*
+ * resolve_async - Have a resolver thread look up rq->host:rq->port, store
+ *     the answer in the cache and call rq->done(rq). Needs resolve_init
+ *     with at least one thread.
+ */
+void resolve_async(resolve_req_t *rq)
+{
+    ajob_t *job = Malloc(sizeof(ajob_t));
+
+    job->rq = rq;
+    job->next = NULL;
+    P(&qmutex);
+    if (atail)
+        atail->next = job;
+    else
+        ahead = job;
+    atail = job;
+    V(&qmutex);
+    V(&qitems);
+}
+
+/*
+ * open_clientfd_cached - open_clientfd with the address list taken from
+ *     the cache. Returns -2 if the name does not resolve, -1 otherwise.
+ */
+int open_clientfd_cached(char *host, char *port)
+{
+    addrset_t set;
+    int i, clientfd;
+
+    if (resolve(host, port, &set) != 0)
+        return -2;
+    for (i = 0; i < set.naddrs; i++) {
+        if ((clientfd = socket(set.addrs[i].family, set.addrs[i].socktype,
+                               set.addrs[i].protocol)) < 0)
+            continue; /* Socket failed, try the next */
+        if (connect(clientfd, (SA *)&set.addrs[i].addr, set.addrs[i].addrlen) != -1)
+            return clientfd; /* Success */
+        close(clientfd); /* Connect failed, try another */
+    }
+    return -1;
+}
+
+//resolve_print_stats - 캐시 히트/미스와 절약한 해석 시간 출력 (시그널 핸들러에서 호출 가능)
+void resolve_print_stats(void)
+{
+    unsigned long hits = nhits, misses = nmisses, ns = miss_ns;
+    unsigned long avg_us = misses ? ns / misses / 1000 : 0;
+
+    sio_puts("resolve: hits ");
+    sio_putl(hits);
+    sio_puts(" misses ");
+    sio_putl(misses);
+    sio_puts(" avg_miss_us ");
+    sio_putl(avg_us);
+    sio_puts(" saved_us ");
+    sio_putl(hits * avg_us);
+    sio_puts("\n");
+}
+
+/* resolver_thread - Run async lookups and refresh entries handed over by resolve_try() */
+static void *resolver_thread(void *vargp)
+{
+    entry_t *ep;
+    ajob_t *job;
+    resolve_req_t *rq;
+    struct timespec start;
+    addrset_t set;
+    int err;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+        P(&qitems);
+        P(&qmutex);
+        if ((job = ahead)) {   /* A caller is waiting on these; refreshes can wait */
+            if (!(ahead = job->next))
+                atail = NULL;
+            ep = NULL;
+        }
+        else {
+            ep = queue[qfront];
+            qfront = (qfront + 1) % QSIZE;
+            qcount--;
+        }
+        V(&qmutex);
+
+        if (job) {
+            rq = job->rq;
+            Free(job);
+            //앞선 조회가 이미 같은 이름을 캐시에 넣었으면 getaddrinfo를 다시 돌리지 않는다
+            if ((rq->err = resolve_try(rq->host, rq->port, &rq->set)) == RESOLVE_MISS) {
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                rq->err = lookup(rq->host, rq->port, &rq->set);
+                P(&mutex);
+                nmisses++;
+                miss_ns += elapsed_ns(&start);
+                store(rq->host, rq->port, rq->err, &rq->set);
+                V(&mutex);
+            }
+            rq->done(rq);
+            continue;
+        }
+
+        err = lookup(ep->host, ep->port, &set);   /* host/port never change */
+
+        P(&mutex);
+        if (!err) {
+            ep->err = 0;
+            ep->set = set;
+            ep->expires = time(NULL) + RESOLVE_TTL;
+        }
+        else if (ep->err) {
+            ep->err = err;
+            ep->expires = time(NULL) + RESOLVE_NEG_TTL;
+        }
+        else {  /* Keep serving the old addresses, look up again on expiry */
+            ep->expires = time(NULL) + RESOLVE_NEG_TTL;
+            ep->refresh_failed = 1;
+        }
+        ep->refreshing = 0;
+        V(&mutex);
+    }
+    return NULL;
+}
+
+/* find -Look up host:port; caller holds mutex */
+static entry_t *find(const char *host, const char *port)
+{
+    entry_t *ep;
+
+    for (ep = buckets[hash(host, port)]; ep; ep = ep->next)
+        if (!strcmp(ep->host, host) && !strcmp(ep->port, port))
+            return ep;
+    return NULL;
+}
+
+/* store - Remember the result of a foreground lookup; caller holds mutex */
+static void store(const char *host, const char *port, int err, addrset_t *set)
+{
+    entry_t *ep;
+    time_t now = time(NULL);
+
+    if (!(ep = find(host, port)) && nentries == MAXENTRIES)
+        sweep(now);
+    if (!ep && nentries < MAXENTRIES) {
+        unsigned h = hash(host, port);
+
+        ep = Calloc(1, sizeof(entry_t));
+        ep->host = Malloc(strlen(host) + 1);
+        strcpy(ep->host, host);
+        ep->port = Malloc(strlen(port) + 1);
+        strcpy(ep->port, port);
+        ep->next = buckets[h];
+        buckets[h] = ep;
+        nentries++;
+    }
+    if (ep) {
+        ep->err = err;
+        ep->refresh_failed = 0;
+        if (!err)
+            ep->set = *set;
+        ep->expires = now + (err ? RESOLVE_NEG_TTL : RESOLVE_TTL);
+    }
+}
+
+/*
+ * sweep - Free expired entries to make room for new names; at most once
+ *     a second, as a full table of live entries would make every miss
+ *     walk it. Queued entries stay: the resolver threads hold them.
+ *     Caller holds mutex.
+ */
+static void sweep(time_t now)
+{
+    entry_t **pp, *ep;
+    int i;
+
+    if (now == last_sweep)
+        return;
+    last_sweep = now;
+    for (i = 0; i < NBUCKETS; i++)
+        for (pp = &buckets[i]; (ep = *pp); ) {
+            if (now >= ep->expires && !ep->refreshing) {
+                *pp = ep->next;
+                Free(ep->host);
+                Free(ep->port);
+                Free(ep);
+                nentries--;
+            }
+            else
+                pp = &ep->next;
+        }
+}
+
+/* FNV-1a hash of host and port */
+static unsigned hash(const char *host, const char *port)
+{
+    unsigned h = 2166136261u;
+    const char *s;
+
+    for (s = host; *s; s++)
+        h = (h ^ (unsigned char)*s) * 16777619u;
+    for (s = port; *s; s++)
+        h = (h ^ (unsigned char)*s) * 16777619u;
+    return h & (NBUCKETS - 1);
+}
+
+/* lookup - Run getaddrinfo with open_clientfd's hints and copy the result */
+static int lookup(const char *host, const char *port, addrset_t *set)
+{
+    struct addrinfo hints, *listp, *p;
+    int rc;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;  /* Open a connection */
+    hints.ai_flags = AI_NUMERICSERV;  /* ... using a numeric port arg. */
+    hints.ai_flags |= AI_ADDRCONFIG;  /* Recommended for connections */
+    if ((rc = getaddrinfo(host, port, &hints, &listp)) != 0)
+        return rc;
+
+    set->naddrs = 0;
+    for (p = listp; p && set->naddrs < RESOLVE_MAXADDRS; p = p->ai_next) {
+        set->addrs[set->naddrs].family = p->ai_family;
+        set->addrs[set->naddrs].socktype = p->ai_socktype;
+        set->addrs[set->naddrs].protocol = p->ai_protocol;
+        set->addrs[set->naddrs].addrlen = p->ai_addrlen;
+        memcpy(&set->addrs[set->naddrs].addr, p->ai_addr, p->ai_addrlen);
+        set->naddrs++;
+    }
+    freeaddrinfo(listp);
+    return 0;
+}
+
+static long elapsed_ns(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec);
+}
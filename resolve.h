@@ -0,0 +1,45 @@
+/*
+ * resolve.h - Shared hostname -> address cache in front of getaddrinfo
+ */
+#ifndef __RESOLVE_H__
+#define __RESOLVE_H__
+
+#include "csapp.h"
+
+#define RESOLVE_MAXADDRS 8    /* Addresses kept per name */
+#define RESOLVE_TTL      60   /* Seconds a successful lookup is trusted */
+#define RESOLVE_NEG_TTL  5    /* Seconds a failed lookup is remembered */
+#define RESOLVE_NTHREADS 2    /* Default background refresh threads */
+
+/* Copy of a getaddrinfo result that callers own */
+typedef struct {
+    int naddrs;
+    struct {
+        int family, socktype, protocol;
+        socklen_t addrlen;
+        struct sockaddr_storage addr;
+    } addrs[RESOLVE_MAXADDRS];
+} addrset_t;
+
+#define RESOLVE_MISS (-1000) /* resolve_try: not cached (not a getaddrinfo code) */
+
+/*
+ * Lookup handed to the resolver threads by resolve_async. The caller owns
+ * it and fills in host, port and done; err and set are filled in before
+ * done(rq) is called on a resolver thread.
+ */
+typedef struct resolve_req {
+    const char *host, *port;
+    int err;                  /* As resolve() would return */
+    addrset_t set;            /* Valid if err == 0 */
+    void (*done)(struct resolve_req *rq);
+} resolve_req_t;
+
+void resolve_init(int nthreads);
+int resolve(const char *host, const char *port, addrset_t *set);
+int resolve_try(const char *host, const char *port, addrset_t *set);
+void resolve_async(resolve_req_t *rq);
+int open_clientfd_cached(char *host, char *port);
+void resolve_print_stats(void);
+
+#endif /* __RESOLVE_H__ */
@@ -0,0 +1,262 @@
+/*
+ * rewrite.c - One-pass rewriter for requests forwarded to origin servers
+ *
+ * 원 서버로 보낼 요청(요청 라인 + 고정 헤더 + 클라이언트 헤더 + Host)을 reqbuf_t의
+ * 버퍼 하나에 앞에서부터 차례로 memcpy해서 만든다.
+ *  - 헤더 이름은 첫 글자로 후보를 좁힌 뒤 한 번만 비교한다.
+ *  - hop-by-hop 헤더(Connection, Keep-Alive, TE, Trailer, Upgrade, Proxy-*)와
+ *    클라이언트의 Connection 값에 이름이 나온 헤더는 원 서버로 보내지 않는다.
+ *    Connection보다 먼저 붙인 헤더가 나중에 이름이 나오면 그때 그 줄만 빼낸다.
+ *  - 스레드 엔진은 rio_readlineb로 다음 줄을 rewrite_tail() 자리에 바로 읽으므로
+ *    남길 헤더는 길이만 늘리면 되고 복사가 전혀 없다.
+ *  - strcat / sprintf(buf + strlen(buf), ...)처럼 버퍼를 처음부터 다시 훑지 않는다.
+ */
+#include "rewrite.h"
+
+/* Room kept for the default Host header and the blank line */
+#define TAILROOM (MAXLINE + 16)
+
+/* You won't lose style points for including this long line in your code */
+static const char *user_agent_hdr =
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 "
+    "Firefox/10.0.3\r\n";
+static size_t user_agent_len;
+
+enum { HDR_KEEP, HDR_DROP, HDR_HOST, HDR_CONN, HDR_BODY };
+
+static int classify(const char *line);
+static void put(reqbuf_t *rb, const char *s, size_t n);
+static const char *next_token(const char *p, size_t *len);
+static void add_conn_names(reqbuf_t *rb, const char *value);
+static int conn_named(reqbuf_t *rb, const char *line);
+static void drop_named(reqbuf_t *rb, const char *name);
+
+/*
+ * rewrite_start - Begin a request with the request line and the headers
+ *     the proxy always sends. keepalive asks the origin to keep the
+ *     connection open; otherwise Connection and Proxy-Connection are close.
+ */
+void rewrite_start(reqbuf_t *rb, const char *method, const char *path, int keepalive)
+{
+    static const char ka[] = "Connection: keep-alive\r\n";
+    static const char cl[] = "Connection: close\r\nProxy-Connection: close\r\n";
+
+    if (!user_agent_len)
+        user_agent_len = strlen(user_agent_hdr);
+    rb->len = 0;
+    rb->has_host = 0;
+    rb->conn = -1;
+    rb->hasbody = 0;
+    rb->nconn_names = 0;
+
+    put(rb, method, strlen(method));
+    put(rb, " ", 1);
+    put(rb, path, strlen(path));
+    put(rb, keepalive ? " HTTP/1.1\r\n" : " HTTP/1.0\r\n", 11);
+    put(rb, user_agent_hdr, user_agent_len);
+    if (keepalive)
+        put(rb, ka, sizeof(ka) - 1);
+    else
+        put(rb, cl, sizeof(cl) - 1);
+    rb->hdrs = rb->len;
+}
+
+//rewrite_tail - 다음 헤더 줄(MAXLINE)을 바로 읽어 넣어도 되는 위치, 자리가 없으면 NULL
+char *rewrite_tail(reqbuf_t *rb)
+{
+    return rb->len + MAXLINE + TAILROOM <= REQSIZE ? rb->buf + rb->len : NULL;
+}
+
+/*
+ * rewrite_header - Take one client header line of n bytes (CRLF included).
+ *     User-Agent and hop-by-hop headers are dropped, as are the headers
+ *     the client's Connection names; Connection and Proxy-Connection
+ *     otherwise only set rb->conn. Content-Length and
+ *     Transfer-Encoding are dropped too, since the proxy never forwards a
+ *     request body; a body sets rb->hasbody. Other lines are appended, or
+ *     just accounted for if the caller read them in place at rewrite_tail().
+ *     Returns 0, or -1 if the line no longer fits: the request must then
+ *     be refused, as forwarding it without the line would change it.
+ */
+int rewrite_header(reqbuf_t *rb, const char *line, size_t n)
+{
+    const char *value;
+
+    switch (classify(line)) {
+    case HDR_DROP:
+        return 0;
+    case HDR_CONN:
+        value = strchr(line, ':') + 1;
+        if (has_token(value, "close"))
+            rb->conn = 0;
+        else if (has_token(value, "keep-alive"))
+            rb->conn = 1;
+        add_conn_names(rb, value);
+        return 0;
+    case HDR_BODY:
+        //본문은 전달하지 않으므로 원 서버가 본문을 기다리지 않게 경계 헤더도 보내지 않는다
+        rb->hasbody = 1;
+        return 0;
+    case HDR_HOST:
+        rb->has_host = 1;
+        break;
+    default:
+        if (rb->nconn_names && conn_named(rb, line))
+            return 0;
+        break;
+    }
+
+    if (line == rb->buf + rb->len)      /* Already in place */
+        rb->len += n;
+    else if (rb->len + n + TAILROOM <= REQSIZE)
+        put(rb, line, n);
+    else
+        return -1;
+    return 0;
+}
+
+//rewrite_finish - 클라이언트가 Host를 보내지 않았으면 URI의 host[:port]로 채우고 빈 줄로 끝낸다
+void rewrite_finish(reqbuf_t *rb, const char *hostname, const char *port)
+{
+    if (!rb->has_host) {
+        put(rb, "Host: ", 6);
+        put(rb, hostname, strlen(hostname));
+        if (strcmp(port, "80")) {
+            put(rb, ":", 1);
+            put(rb, port, strlen(port));
+        }
+        put(rb, "\r\n", 2);
+    }
+    put(rb, "\r\n", 2);
+}
+
+//has_token - 쉼표로 나뉜 헤더 값 중에 token과 (대소문자 무시) 똑같은 항목이 있는지.
+//"closed"나 "x-keep-alive"는 "close" / "keep-alive"가 아니다. 줄 끝에서 멈춘다
+int has_token(const char *value, const char *token)
+{
+    size_t tlen = strlen(token), len;
+
+    while ((value = next_token(value, &len))) {
+        if (len == tlen && !strncasecmp(value, token, len))
+            return 1;
+        value += len;
+    }
+    return 0;
+}
+
+/* next_token - Start of the next comma-separated item at or after p and
+ *     its length without surrounding whitespace; NULL at end of line */
+static const char *next_token(const char *p, size_t *len)
+{
+    const char *end;
+
+    while (*p == ' ' || *p == '\t' || *p == ',')
+        p++;
+    if (!*p || *p == '\r' || *p == '\n')
+        return NULL;
+    for (end = p; *end && *end != ',' && *end != '\r' && *end != '\n'; end++)
+        ;
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+        end--;
+    *len = end - p;
+    return p;
+}
+
+/* add_conn_names - Remember the header names a Connection value lists,
+ *     and take out any of those headers already appended */
+static void add_conn_names(reqbuf_t *rb, const char *value)
+{
+    size_t len;
+
+    while ((value = next_token(value, &len))) {
+        if (len < CONN_NAMELEN && rb->nconn_names < CONN_MAXNAMES &&
+            (len != 5 || strncasecmp(value, "close", 5)) &&
+            (len != 10 || strncasecmp(value, "keep-alive", 10))) {
+            memcpy(rb->conn_names[rb->nconn_names], value, len);
+            rb->conn_names[rb->nconn_names][len] = '\0';
+            drop_named(rb, rb->conn_names[rb->nconn_names++]);
+        }
+        value += len;
+    }
+}
+
+/* conn_named - Is line a header the client's Connection listed? */
+static int conn_named(reqbuf_t *rb, const char *line)
+{
+    const char *colon = strchr(line, ':');
+    size_t len;
+    int i;
+
+    if (!colon)
+        return 0;
+    len = colon - line;
+    for (i = 0; i < rb->nconn_names; i++)
+        if (!strncasecmp(line, rb->conn_names[i], len) && !rb->conn_names[i][len])
+            return 1;
+    return 0;
+}
+
+/* drop_named - Remove appended client headers called name. Only runs when
+ *     a Connection line lists a header that came before it */
+static void drop_named(reqbuf_t *rb, const char *name)
+{
+    size_t len = strlen(name), n;
+    char *p = rb->buf + rb->hdrs, *end = rb->buf + rb->len, *eol;
+
+    while (p < end) {
+        eol = memchr(p, '\n', end - p);
+        n = eol ? eol + 1 - p : (size_t)(end - p);
+        if (!strncasecmp(p, name, len) && p[len] == ':') {
+            memmove(p, p + n, end - p - n);
+            end -= n;
+            rb->len -= n;
+        }
+        else
+            p += n;
+    }
+}
+
+/* classify - Decide what happens to a header by its name */
+static int classify(const char *line)
+{
+    switch (line[0] | 0x20) {           /* Lower-case the first letter */
+    case 'h':
+        if (!strncasecmp(line, "Host:", 5))
+            return HDR_HOST;
+        break;
+    case 'u':
+        if (!strncasecmp(line, "User-Agent:", 11) || !strncasecmp(line, "Upgrade:", 8))
+            return HDR_DROP;
+        break;
+    case 'k':
+        if (!strncasecmp(line, "Keep-Alive:", 11))
+            return HDR_DROP;
+        break;
+    case 'c':
+        if (!strncasecmp(line, "Connection:", 11))
+            return HDR_CONN;
+        if (!strncasecmp(line, "Content-Length:", 15))
+            return strtol(line + 15, NULL, 10) > 0 ? HDR_BODY : HDR_DROP;
+        break;
+    case 'p':
+        if (!strncasecmp(line, "Proxy-Connection:", 17))
+            return HDR_CONN;
+        if (!strncasecmp(line, "Proxy-Authorization:", 20))
+            return HDR_DROP;
+        break;
+    case 't':
+        if (!strncasecmp(line, "Transfer-Encoding:", 18))
+            return HDR_BODY;
+        if (!strncasecmp(line, "TE:", 3) || !strncasecmp(line, "Trailer:", 8))
+            return HDR_DROP;
+        break;
+    }
+    return HDR_KEEP;
+}
+
+/* put - Append n bytes; callers keep TAILROOM free so this can't overflow */
+static void put(reqbuf_t *rb, const char *s, size_t n)
+{
+    memcpy(rb->buf + rb->len, s, n);
+    rb->len += n;
+}
@@ -0,0 +1,30 @@
+/*
+ * rewrite.h - One-pass rewriter for requests forwarded to origin servers
+ */
+#ifndef __REWRITE_H__
+#define __REWRITE_H__
+
+#include "csapp.h"
+
+#define REQSIZE (4*MAXLINE)  /* Upstream request: line + headers + blank line */
+#define CONN_MAXNAMES 8       /* Header names listed in Connection that are dropped */
+#define CONN_NAMELEN  32      /* Longer names can't be listed */
+
+typedef struct {
+    char buf[REQSIZE];       /* Request being built, reused across requests */
+    size_t len;              /* Bytes in buf */
+    int has_host;            /* Client sent its own Host header */
+    int conn;                /* Client's Connection: 1 keep-alive, 0 close, -1 none */
+    int hasbody;             /* Client request carries a body */
+    size_t hdrs;             /* Where the client's headers start in buf */
+    char conn_names[CONN_MAXNAMES][CONN_NAMELEN]; /* Named by Connection: hop-by-hop */
+    int nconn_names;
+} reqbuf_t;
+
+void rewrite_start(reqbuf_t *rb, const char *method, const char *path, int keepalive);
+char *rewrite_tail(reqbuf_t *rb);
+int rewrite_header(reqbuf_t *rb, const char *line, size_t n);
+void rewrite_finish(reqbuf_t *rb, const char *hostname, const char *port);
+int has_token(const char *value, const char *token);
+
+#endif /* __REWRITE_H__ */
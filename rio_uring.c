@@ -0,0 +1,653 @@
+/*
+ * rio_uring.c - io_uring backend for the rio package
+ *
+ * rio_uring_init이 성공하면 rio_readn / rio_writen / rio_writev / rio_read(버퍼 채우기)가
+ * read/write 시스템 콜 대신 스레드마다 하나씩 만드는 io_uring으로 I/O를 한다.
+ * liburing 없이 io_uring_setup / io_uring_enter / io_uring_register를 직접 부른다.
+ *
+ *  - 쓰기는 바로 제출하지 않고 등록된(registered) 스테이징 버퍼에 복사해 모아 둔다.
+ *    같은 fd에 이어지는 쓰기는 한 건으로 합친다. 모인 쓰기는 다음 읽기와 같은
+ *    io_uring_enter 한 번으로 제출(WRITE_FIXED)되므로 "원 서버에 요청 쓰기 + 응답 읽기",
+ *    "클라이언트에 응답 쓰기 + 다음 요청 읽기"가 각각 시스템 콜 하나가 된다.
+ *  - 모아 둔 쓰기가 실패하면 그 fd의 다음 rio 호출, rio_flush, Close가 에러를 돌려준다.
+ *  - 스테이징 버퍼보다 큰 쓰기는 그 fd의 앞선 쓰기가 끝나기를 기다린 뒤 바로 제출한다.
+ *  - IORING_OP_READ는 소켓의 SO_RCVTIMEO를 무시하므로, 읽기마다 그 값으로
+ *    IORING_OP_LINK_TIMEOUT을 이어 건다 -> read()처럼 시간이 지나면 EAGAIN.
+ *    값은 fd마다 처음 읽을 때 getsockopt로 한 번만 알아 두고 rio_flush(Close)에서 잊는다.
+ *  - uring_accept_arm / uring_accept_next: multishot accept. 한 번 제출하면 연결이
+ *    들어올 때마다 CQE가 생기므로, 링 fd를 epoll에 등록해 두면 accept 시스템 콜이 필요 없다.
+ *
+ * 쓰기가 늦게 나가므로 rio 밖에서 같은 fd를 직접 다루기(splice 등) 전에는 rio_flush를
+ * 불러야 하고, fd는 Close로 닫아야 한다. SO_RCVTIMEO는 첫 읽기 전에 정해야 한다. 링을 만들 수 없는 스레드는 보통 시스템 콜을 쓴다.
+ */
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/io_uring.h>
+#include "rio_uring.h"
+
+/* user_data of a CQE: tag in the low two bits, wreq_t index above it */
+#define UD_SYNC    0   /* The read or write the caller is waiting for */
+#define UD_WRITE   1   /* Deferred write */
+#define UD_ACCEPT  2   /* Multishot accept */
+#define UD_TIMEOUT 3   /* Timeout linked to a UD_SYNC read */
+#define UD_TAG(ud) ((ud) & 3)
+
+#define URING_MAXERR  8    /* Descriptors with a failed deferred write */
+#define URING_ACCEPTQ 64   /* Initial room for reaped accept results */
+#define URING_MAXREARM 8   /* Accepts that may end in a row with no connection */
+#define URING_MAXFDS  (1 << 20)  /* Most descriptors whose SO_RCVTIMEO is remembered */
+
+/* Deferred write: len bytes at wbuf + off still to go to fd */
+typedef struct {
+    int fd;
+    size_t off, len;
+    int inflight;                  /* Submitted, CQE not reaped yet */
+} wreq_t;
+
+/* Per-thread ring */
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, *sq_flags;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sq_entries;
+    char *wbuf;                    /* Staging buffer for deferred writes */
+    size_t wlen;                   /* Bytes of wbuf handed out */
+    int fixed;                     /* wbuf is registered buffer 0 */
+    wreq_t w[URING_MAXW];          /* Deferred writes in submission order */
+    int nw;
+    int sync_done, sync_res;       /* CQE of the UD_SYNC request */
+    struct { int fd, err; } err[URING_MAXERR];
+    int nerr;
+    int listenfd, acceptflags;     /* Multishot accept (listenfd < 0: none) */
+    int armed;                     /* Accept request still active */
+    int rearms;                    /* Re-armed since the last accepted connection */
+    int *acq;                      /* cqe->res of reaped accepts, grows */
+    int acq_pos, acq_len, acq_cap; /* Next to take, filled, allocated */
+} ring_t;
+
+static ssize_t uring_read(int fd, void *buf, size_t n);
+static ssize_t uring_write(int fd, void *buf, size_t n);
+static ssize_t uring_writev(int fd, struct iovec *iov, int iovcnt);
+static int uring_flush(int fd);
+
+static rio_backend_t uring_backend = {
+    uring_read, uring_write, uring_writev, uring_flush
+};
+
+static int uring_on;                   /* rio_uring_init succeeded */
+static __thread ring_t *ring;          /* This thread's ring, made on first use */
+static __thread int ring_failed;       /* io_uring_setup failed in this thread */
+static unsigned long n_enters, n_sqes; /* Statistics for SIGUSR1 */
+static int *rcvtimeo;                  /* SO_RCVTIMEO (ms) by fd, -1: not looked up */
+static int nrcvtimeo;                  /* Entries in rcvtimeo */
+
+static ring_t *get_ring(void);
+static ring_t *ring_create(void);
+static struct io_uring_sqe *get_sqe(ring_t *r);
+static int ring_enter(ring_t *r, unsigned min_complete);
+static void reap(ring_t *r);
+static void issue_writes(ring_t *r);
+static void wait_writes(ring_t *r, int fd);
+static ssize_t wait_sync(ring_t *r);
+static void arm_accept(ring_t *r);
+static int rcv_timeout(int fd);
+static int fd_error(ring_t *r, int fd, int clear);
+static void set_error(ring_t *r, int fd, int err);
+
+/*
+ * rio_uring_init - Route rio I/O through io_uring. Returns -1, leaving
+ *     the read/write path in place, if this kernel can't set up a ring.
+ *     Call before starting threads.
+ */
+int rio_uring_init(void)
+{
+    struct rlimit rl;
+
+    if (!get_ring())
+        return -1;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    nrcvtimeo = rl.rlim_cur < URING_MAXFDS ? rl.rlim_cur : URING_MAXFDS;
+    rcvtimeo = Malloc(nrcvtimeo * sizeof(int));
+    memset(rcvtimeo, 0xff, nrcvtimeo * sizeof(int)); /* All -1 */
+    rio_set_backend(&uring_backend);
+    uring_on = 1;
+    return 0;
+}
+
+int rio_uring_enabled(void)
+{
+    return uring_on;
+}
+
+/*
+ * uring_accept_arm - Start a multishot accept on listenfd in this
+ *     thread's ring; accepted descriptors get flags (SOCK_NONBLOCK,
+ *     SOCK_CLOEXEC). Returns the ring descriptor, which becomes readable
+ *     when uring_accept_next has something, or -1 if this kernel can't do
+ *     a multishot accept; the caller then uses accept4 on listenfd.
+ */
+int uring_accept_arm(int listenfd, int flags)
+{
+    ring_t *r = get_ring();
+
+    if (!r)
+        return -1;
+    r->listenfd = listenfd;
+    r->acceptflags = flags;
+    r->rearms = 0;
+    arm_accept(r);
+    if (ring_enter(r, 0) < 0) {
+        r->listenfd = -1;
+        return -1;
+    }
+    //multishot accept를 모르는 커널(5.19 전)은 제출하자마자 -EINVAL로 끝낸다.
+    //연결 없이 바로 끝난 accept는 이미 거둬 들였으므로 링 fd로는 알 수 없다 -> 여기서 포기
+    if (!r->armed) {
+        errno = r->acq_len > 0 && r->acq[r->acq_len - 1] < 0 ? -r->acq[r->acq_len - 1] : EINVAL;
+        r->listenfd = -1;
+        r->acq_pos = r->acq_len = 0;
+        return -1;
+    }
+    return r->fd;
+}
+
+/*
+ * uring_accept_next - Next accepted descriptor, without a system call.
+ *     Returns -1 with errno EAGAIN when none is pending, or with the
+ *     accept error. If the accept keeps ending without a connection
+ *     (URING_MAXREARM times in a row) it is not armed again: once the
+ *     results already reaped are taken, errno is EOPNOTSUPP and the
+ *     caller should accept4 on the listening socket instead.
+ */
+int uring_accept_next(void)
+{
+    ring_t *r = ring;
+    int res;
+
+    if (!r) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    if (r->listenfd >= 0) {
+        reap(r);
+        //에러 등으로 multishot이 끝났으면 바로 다시 건다 (안 그러면 링 fd가 다시는 깨지 않음)
+        //연결을 하나도 받지 못한 채 계속 끝나면 포기한다 -> 링 fd에서 에러만 도는 일이 없게
+        if (!r->armed) {
+            if (r->rearms++ < URING_MAXREARM) {
+                arm_accept(r);
+                ring_enter(r, 0);
+            }
+            else
+                r->listenfd = -1;
+        }
+    }
+    if (r->acq_pos == r->acq_len) {
+        r->acq_pos = r->acq_len = 0;
+        errno = r->listenfd >= 0 ? EAGAIN : EOPNOTSUPP;
+        return -1;
+    }
+    res = r->acq[r->acq_pos++];
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+    r->rearms = 0;
+    return res;
+}
+
+void rio_uring_print_stats(void)
+{
+    sio_puts("uring: enters ");
+    sio_putl(__atomic_load_n(&n_enters, __ATOMIC_RELAXED));
+    sio_puts(" sqes ");
+    sio_putl(__atomic_load_n(&n_sqes, __ATOMIC_RELAXED));
+    sio_puts("\n");
+}
+
+/*
+ * Backend functions - same results as read, write and writev
+ */
+
+static ssize_t uring_read(int fd, void *buf, size_t n)
+{
+    ring_t *r = get_ring();
+    struct io_uring_sqe *sqe;
+    struct __kernel_timespec ts;
+    ssize_t rc;
+    int ms;
+
+    if (!r)
+        return read(fd, buf, n);
+    if (fd_error(r, fd, 0))
+        return -1;
+    issue_writes(r); //모아 둔 쓰기가 이 읽기와 같은 enter로 나간다
+    ms = rcv_timeout(fd);
+    //읽기와 이어 거는 timeout이 서로 다른 enter로 갈라지지 않게 자리를 두 개 확보
+    while (*r->sq_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) + 2 > r->sq_entries)
+        ring_enter(r, 0);
+    sqe = get_sqe(r);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = n;
+    sqe->off = (__u64)-1; /* Current file position, like read() */
+    sqe->user_data = UD_SYNC;
+    if (ms > 0) {
+        sqe->flags = IOSQE_IO_LINK;
+        ts.tv_sec = ms / 1000;
+        ts.tv_nsec = (ms % 1000) * 1000000L;
+        sqe = get_sqe(r);
+        sqe->opcode = IORING_OP_LINK_TIMEOUT;
+        sqe->addr = (unsigned long)&ts; /* Copied when submitted, in wait_sync */
+        sqe->len = 1;
+        sqe->user_data = UD_TIMEOUT;
+    }
+    //시간 안에 아무것도 오지 않으면 읽기가 취소된다 -> read()의 SO_RCVTIMEO처럼 EAGAIN
+    if ((rc = wait_sync(r)) < 0 && errno == ECANCELED)
+        errno = EAGAIN;
+    return rc;
+}
+
+static ssize_t uring_write(int fd, void *buf, size_t n)
+{
+    struct iovec iov;
+
+    iov.iov_base = buf;
+    iov.iov_len = n;
+    return uring_writev(fd, &iov, 1);
+}
+
+/*
+ * uring_writev - Copy the bytes into the staging buffer and report them
+ *     written; they are submitted with this thread's next read or flush.
+ */
+static ssize_t uring_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    ring_t *r = get_ring();
+    struct io_uring_sqe *sqe;
+    wreq_t *w;
+    size_t total = 0;
+    int i, merge;
+
+    if (!r)
+        return writev(fd, iov, iovcnt);
+    if (fd_error(r, fd, 0))
+        return -1;
+    for (i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+    if (total == 0)
+        return 0;
+
+    //스테이징 버퍼에 들어가지 않는 쓰기: 순서를 지키려고 이 fd의 앞선 쓰기를 기다린 뒤 바로 보낸다
+    if (total > URING_WBUFSIZE) {
+        wait_writes(r, fd);
+        if (fd_error(r, fd, 0))
+            return -1;
+        issue_writes(r);
+        sqe = get_sqe(r);
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = fd;
+        sqe->addr = (unsigned long)iov;
+        sqe->len = iovcnt;
+        sqe->off = (__u64)-1;
+        sqe->user_data = UD_SYNC;
+        return wait_sync(r);
+    }
+
+    //같은 fd로 이어지는 아직 제출 안 된 쓰기 뒤에는 그대로 붙여서 한 건으로 만든다
+    w = r->nw ? &r->w[r->nw - 1] : NULL;
+    merge = w && w->fd == fd && !w->inflight && w->len > 0 && w->off + w->len == r->wlen;
+    if (r->wlen + total > URING_WBUFSIZE || (!merge && r->nw == URING_MAXW)) {
+        wait_writes(r, -1); /* Staging buffer starts over */
+        if (fd_error(r, fd, 0))
+            return -1;
+        merge = 0;
+    }
+    if (!merge) {
+        w = &r->w[r->nw++];
+        w->fd = fd;
+        w->off = r->wlen;
+        w->len = 0;
+        w->inflight = 0;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(r->wbuf + r->wlen, iov[i].iov_base, iov[i].iov_len);
+        r->wlen += iov[i].iov_len;
+    }
+    w->len += total;
+    return total;
+}
+
+/* uring_flush - Wait for fd's deferred writes and forget its error and
+ *     receive timeout; Close calls this, so a reused fd looks it up again */
+static int uring_flush(int fd)
+{
+    ring_t *r = ring;
+
+    if (fd >= 0 && fd < nrcvtimeo)
+        __atomic_store_n(&rcvtimeo[fd], -1, __ATOMIC_RELAXED);
+    if (!r)
+        return 0;
+    wait_writes(r, fd);
+    return fd_error(r, fd, 1) ? -1 : 0;
+}
+
+/*
+ * Ring helpers
+ */
+
+static ring_t *get_ring(void)
+{
+    if (!ring && !ring_failed && !(ring = ring_create()))
+        ring_failed = 1;
+    return ring;
+}
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg,
+                                 unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* ring_create - Set up and map a ring; NULL if io_uring isn't available */
+static ring_t *ring_create(void)
+{
+    struct io_uring_params p;
+    struct iovec iov;
+    ring_t *r;
+    size_t sqsize, cqsize;
+    char *sq, *cq;
+    void *sqes;
+    int fd;
+
+    memset(&p, 0, sizeof(p));
+    if ((fd = sys_io_uring_setup(URING_ENTRIES, &p)) < 0)
+        return NULL;
+    sqsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sqsize = cqsize = sqsize > cqsize ? sqsize : cqsize;
+    sq = mmap(NULL, sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              fd, IORING_OFF_SQ_RING);
+    cq = (p.features & IORING_FEAT_SINGLE_MMAP) ? sq :
+        mmap(NULL, cqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+             fd, IORING_OFF_CQ_RING);
+    sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+        close(fd); /* Unmapping is left to exit: this thread won't try again */
+        return NULL;
+    }
+
+    r = Calloc(1, sizeof(ring_t));
+    r->fd = fd;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->sq_flags = (unsigned *)(sq + p.sq_off.flags);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->sqes = sqes;
+    r->sq_entries = p.sq_entries;
+    r->listenfd = -1;
+
+    //스테이징 버퍼를 등록해 두면 쓰기마다 커널이 페이지를 고정(pin)하지 않아도 된다
+    r->wbuf = Malloc(URING_WBUFSIZE);
+    iov.iov_base = r->wbuf;
+    iov.iov_len = URING_WBUFSIZE;
+    r->fixed = sys_io_uring_register(fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+    return r;
+}
+
+/*
+ * get_sqe - Next free submission entry, zeroed and already queued.
+ *     Without SQPOLL the kernel reads the queue only in io_uring_enter,
+ *     so the caller can fill it in afterwards.
+ */
+static struct io_uring_sqe *get_sqe(ring_t *r)
+{
+    struct io_uring_sqe *sqe;
+    unsigned tail = *r->sq_tail, idx;
+
+    while (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries)
+        ring_enter(r, 0);
+    idx = tail & *r->sq_mask;
+    sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+/*
+ * ring_enter - Submit everything queued, wait for min_complete
+ *     completions, and reap. Returns -1 only if the ring itself failed.
+ */
+static int ring_enter(ring_t *r, unsigned min_complete)
+{
+    unsigned queued = *r->sq_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    int rc;
+
+    rc = sys_io_uring_enter(r->fd, queued, min_complete,
+                            min_complete ? IORING_ENTER_GETEVENTS : 0);
+    __atomic_add_fetch(&n_enters, 1, __ATOMIC_RELAXED);
+    if (rc > 0)
+        __atomic_add_fetch(&n_sqes, rc, __ATOMIC_RELAXED);
+    if (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        return -1;
+    reap(r);
+    return 0;
+}
+
+/*
+ * reap - Consume every completion. Completions that didn't fit in the
+ *     completion queue (a burst of accepts) wait in the kernel until an
+ *     io_uring_enter with GETEVENTS moves them over.
+ */
+static void reap(ring_t *r)
+{
+    struct io_uring_cqe *cqe;
+    unsigned head = *r->cq_head;
+    wreq_t *w;
+
+    while (1) {
+        if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+            if (!(__atomic_load_n(r->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW))
+                break;
+            __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+            sys_io_uring_enter(r->fd, 0, 0, IORING_ENTER_GETEVENTS);
+            __atomic_add_fetch(&n_enters, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        cqe = &r->cqes[head & *r->cq_mask];
+        switch (UD_TAG(cqe->user_data)) {
+        case UD_SYNC:
+            r->sync_done = 1;
+            r->sync_res = cqe->res;
+            break;
+        case UD_WRITE:
+            w = &r->w[cqe->user_data >> 2];
+            w->inflight = 0;
+            if (cqe->res == -EINTR || cqe->res == -EAGAIN)
+                break; /* issue_writes tries again */
+            if (cqe->res <= 0)
+                set_error(r, w->fd, cqe->res < 0 ? -cqe->res : EIO);
+            else {
+                w->off += cqe->res; /* A short write resubmits the rest */
+                w->len -= cqe->res;
+            }
+            break;
+        case UD_ACCEPT:
+            if (!(cqe->flags & IORING_CQE_F_MORE))
+                r->armed = 0;
+            if (r->acq_len == r->acq_cap) {
+                r->acq_cap = r->acq_cap ? 2 * r->acq_cap : URING_ACCEPTQ;
+                r->acq = Realloc(r->acq, r->acq_cap * sizeof(int));
+            }
+            r->acq[r->acq_len++] = cqe->res;
+            break;
+        case UD_TIMEOUT:
+            break; /* The read it guards reports the outcome */
+        }
+        head++;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * issue_writes - Queue every unfinished deferred write whose descriptor
+ *     has no earlier write outstanding, so each fd's bytes stay in order.
+ *     Frees the staging buffer once everything is done.
+ */
+static void issue_writes(ring_t *r)
+{
+    struct io_uring_sqe *sqe;
+    wreq_t *w;
+    int i, j, busy = 0;
+
+    for (i = 0; i < r->nw; i++) {
+        w = &r->w[i];
+        if (w->len > 0 && fd_error(r, w->fd, 0))
+            w->len = 0; /* Already failed; the error is reported instead */
+        if (w->inflight || w->len == 0) {
+            busy |= w->inflight;
+            continue;
+        }
+        busy = 1;
+        for (j = 0; j < i; j++)
+            if (r->w[j].fd == w->fd && r->w[j].len > 0)
+                break;
+        if (j < i)
+            continue;
+        sqe = get_sqe(r);
+        sqe->opcode = r->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = w->fd;
+        sqe->addr = (unsigned long)(r->wbuf + w->off);
+        sqe->len = w->len;
+        sqe->off = (__u64)-1;
+        sqe->buf_index = 0;
+        sqe->user_data = ((__u64)i << 2) | UD_WRITE;
+        w->inflight = 1;
+    }
+    if (!busy)
+        r->nw = r->wlen = 0;
+}
+
+/* wait_writes - Wait until fd (-1: every descriptor) has no deferred writes */
+static void wait_writes(ring_t *r, int fd)
+{
+    int i;
+
+    while (1) {
+        issue_writes(r);
+        for (i = 0; i < r->nw; i++)
+            if (r->w[i].len > 0 && (fd < 0 || r->w[i].fd == fd))
+                break;
+        if (i == r->nw || ring_enter(r, 1) < 0)
+            return;
+    }
+}
+
+/*
+ * wait_sync - Submit with the caller's UD_SYNC entry and wait for its
+ *     result. Deferred writes in flight are waited for as well, as a
+ *     blocking write() would have been: asking for all the completions
+ *     at once keeps it to one io_uring_enter when none comes up short.
+ */
+static ssize_t wait_sync(ring_t *r)
+{
+    unsigned want;
+    int i;
+
+    r->sync_done = 0;
+    while (!r->sync_done) {
+        for (want = 1, i = 0; i < r->nw; i++)
+            want += r->w[i].inflight;
+        if (ring_enter(r, want) < 0)
+            return -1;
+        issue_writes(r); /* Resubmit short deferred writes */
+    }
+    if (*r->sq_tail != __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE))
+        ring_enter(r, 0); /* Don't leave those for the next call */
+    if (r->sync_res < 0) {
+        errno = -r->sync_res;
+        return -1;
+    }
+    return r->sync_res;
+}
+
+static void arm_accept(ring_t *r)
+{
+    struct io_uring_sqe *sqe = get_sqe(r);
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = r->listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = r->acceptflags;
+    sqe->user_data = UD_ACCEPT;
+    r->armed = 1;
+}
+
+/* rcv_timeout - fd's SO_RCVTIMEO in ms, 0 for none; one getsockopt per fd */
+static int rcv_timeout(int fd)
+{
+    struct timeval tv;
+    socklen_t len = sizeof(tv);
+    int ms;
+
+    if (fd < nrcvtimeo && (ms = __atomic_load_n(&rcvtimeo[fd], __ATOMIC_RELAXED)) >= 0)
+        return ms;
+    if (getsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, &len) < 0)
+        ms = 0; /* Not a socket: no timeout */
+    else
+        ms = tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+    if (fd < nrcvtimeo)
+        __atomic_store_n(&rcvtimeo[fd], ms, __ATOMIC_RELAXED);
+    return ms;
+}
+
+/* fd_error - If a deferred write to fd failed, set errno and return 1 */
+static int fd_error(ring_t *r, int fd, int clear)
+{
+    int i;
+
+    for (i = 0; i < r->nerr; i++)
+        if (r->err[i].fd == fd) {
+            errno = r->err[i].err;
+            if (clear)
+                r->err[i] = r->err[--r->nerr];
+            return 1;
+        }
+    return 0;
+}
+
+static void set_error(ring_t *r, int fd, int err)
+{
+    int olderrno = errno;
+
+    if (fd_error(r, fd, 0)) {
+        errno = olderrno;
+        return;
+    }
+    if (r->nerr == URING_MAXERR)
+        r->nerr--; /* Forget the newest to make room */
+    r->err[r->nerr].fd = fd;
+    r->err[r->nerr++].err = err;
+}
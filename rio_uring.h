@@ -0,0 +1,19 @@
+/*
+ * rio_uring.h - io_uring backend for the rio package
+ */
+#ifndef __RIO_URING_H__
+#define __RIO_URING_H__
+
+#include "csapp.h"
+
+#define URING_ENTRIES  64            /* Submission queue size per thread */
+#define URING_WBUFSIZE (128*1024)    /* Registered staging buffer for deferred writes */
+#define URING_MAXW     32            /* Deferred writes outstanding per thread */
+
+int rio_uring_init(void);
+int rio_uring_enabled(void);
+int uring_accept_arm(int listenfd, int flags);
+int uring_accept_next(void);
+void rio_uring_print_stats(void);
+
+#endif /* __RIO_URING_H__ */
@@ -0,0 +1,109 @@
+/*
+ * riobench.c - A/B of rio over read/write and over io_uring (rio_uring.c)
+ *
+ * socketpair 한쪽에서 rio_writen으로 msgsize 바이트를 보내고 rio_readnb로 되돌아온
+ * 응답을 읽는 ping-pong을 iterations번 한다. 반대쪽은 rio를 거치지 않는 echo 스레드.
+ * 먼저 read/write 백엔드로, 그 다음 rio_uring_init 후 io_uring 백엔드로 같은 일을 하고
+ * 왕복 시간과 그동안 이 스레드가 부른 read/write 계열 시스템 콜 수를 출력한다
+ * (/proc/thread-self/io의 syscr + syscw, io_uring_enter 횟수는 uring 통계 줄).
+ *
+ * usage: riobench [msgsize] [iterations]   (기본 512, 100000)
+ */
+#include "rio_uring.h"
+
+static void *echo_thread(void *vargp);
+static void run(const char *name, int msgsize, long iters);
+static long rw_syscalls(void);
+static double now(void);
+
+int main(int argc, char **argv)
+{
+    int msgsize = argc > 1 ? atoi(argv[1]) : 512;
+    long iters = argc > 2 ? atol(argv[2]) : 100000;
+
+    if (msgsize < 1 || iters < 1) {
+        fprintf(stderr, "usage: %s [msgsize] [iterations]\n", argv[0]);
+        exit(1);
+    }
+    run("read/write", msgsize, iters);
+    if (rio_uring_init() < 0) {
+        printf("io_uring unavailable\n");
+        return 0;
+    }
+    run("io_uring", msgsize, iters);
+    fflush(stdout);             /* The stats line is written unbuffered */
+    rio_uring_print_stats();
+    return 0;
+}
+
+/* run - Time iters round trips of msgsize bytes through the current backend */
+static void run(const char *name, int msgsize, long iters)
+{
+    int sv[2];
+    long i, calls;
+    double start;
+    pthread_t tid;
+    rio_t rio;
+    char *buf;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        unix_error("socketpair error");
+    Pthread_create(&tid, NULL, echo_thread, (void *)(long)sv[1]);
+    buf = Malloc(msgsize);
+    memset(buf, 'x', msgsize);
+    rio_readinitb_sz(&rio, sv[0], 65536);
+
+    calls = rw_syscalls();
+    start = now();
+    for (i = 0; i < iters; i++) {
+        if (rio_writen(sv[0], buf, msgsize) != msgsize ||
+            rio_readnb(&rio, buf, msgsize) != msgsize)
+            app_error("short round trip");
+    }
+    start = now() - start;
+    calls = rw_syscalls() - calls;
+    printf("%-10s msg %d: %6.2f us/round trip, %ld read/write syscalls\n",
+           name, msgsize, start / iters * 1e6, calls);
+
+    rio_release(&rio);
+    Close(sv[0]);          /* Echo thread sees EOF and closes its end */
+    Pthread_join(tid, NULL);
+    Free(buf);
+}
+
+/* echo_thread - Send back whatever arrives, with plain read and write */
+static void *echo_thread(void *vargp)
+{
+    int fd = (int)(long)vargp;
+    char buf[65536];
+    ssize_t n, off, rc;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        for (off = 0; off < n; off += rc)
+            if ((rc = write(fd, buf + off, n - off)) < 0)
+                unix_error("echo write error");
+    close(fd);
+    return NULL;
+}
+
+/* rw_syscalls - read and write family system calls made by this thread */
+static long rw_syscalls(void)
+{
+    FILE *fp = Fopen("/proc/thread-self/io", "r");
+    char key[64];
+    long val, total = 0;
+
+    while (fscanf(fp, "%63s %ld", key, &val) == 2)
+        if (!strcmp(key, "syscr:") || !strcmp(key, "syscw:"))
+            total += val;
+    Fclose(fp);
+    return total;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,74 @@
+/*
+ * splice_relay.c - Zero-copy socket-to-socket relay through a pipe
+ *
+ * splice()는 소켓과 파이프 사이에서 커널 안의 페이지만 옮기므로 데이터가
+ * 사용자 공간 버퍼(rio_buf -> usrbuf)로 복사되지 않는다.
+ * 원 서버 소켓 -> 파이프 -> 클라이언트 소켓 순서로 옮기며, 파이프는 스레드마다 하나씩
+ * 만들어 재사용한다.
+ *
+ * splice와 pipe2는 _GNU_SOURCE에서만 선언되는데, 그러면 csapp.h의 gai_error와
+ * 충돌하므로 이 파일은 csapp.h 없이 따로 컴파일한다.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "splice_relay.h"
+
+#define SPLICE_CHUNK 65536  /* Default pipe capacity */
+
+static __thread int pipefd[2] = {-1, -1};
+
+static void reset_pipe(void);
+
+/*
+ * splice_relay - Move len bytes (len < 0: until EOF) from fromfd to tofd.
+ *     Returns the number of bytes moved, which is less than len only at
+ *     EOF, -1 on error, or SPLICE_UNSUPPORTED before anything was moved
+ *     if the descriptors don't support splice.
+ */
+ssize_t splice_relay(int fromfd, int tofd, long len)
+{
+    ssize_t n, m;
+    size_t chunk;
+    long total = 0;
+
+    if (pipefd[0] < 0 && pipe2(pipefd, O_CLOEXEC) < 0)
+        return SPLICE_UNSUPPORTED;
+
+    while (len < 0 || total < len) {
+        chunk = (len < 0 || len - total > SPLICE_CHUNK) ? SPLICE_CHUNK : len - total;
+        n = splice(fromfd, NULL, pipefd[1], NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (total == 0 && (errno == EINVAL || errno == ENOSYS))
+                return SPLICE_UNSUPPORTED;
+            return -1;
+        }
+        if (n == 0)         /* EOF */
+            break;
+
+        /* Drain the pipe into the destination */
+        while (n > 0) {
+            m = splice(pipefd[0], NULL, tofd, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (m < 0 && errno == EINTR)
+                continue;
+            if (m <= 0) {
+                reset_pipe();   /* Don't leak leftover bytes into the next relay */
+                return -1;
+            }
+            n -= m;
+            total += m;
+        }
+    }
+    return total;
+}
+
+/* reset_pipe - Throw away a pipe that may still hold data */
+static void reset_pipe(void)
+{
+    close(pipefd[0]);
+    close(pipefd[1]);
+    pipefd[0] = pipefd[1] = -1;
+}
@@ -0,0 +1,13 @@
+/*
+ * splice_relay.h - Zero-copy socket-to-socket relay through a pipe
+ */
+#ifndef __SPLICE_RELAY_H__
+#define __SPLICE_RELAY_H__
+
+#include <sys/types.h>
+
+#define SPLICE_UNSUPPORTED -2  /* Descriptors can't be spliced; copy instead */
+
+ssize_t splice_relay(int fromfd, int tofd, long len);
+
+#endif /* __SPLICE_RELAY_H__ */
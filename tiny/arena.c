@@ -0,0 +1,95 @@
+/*
+ * arena.c - Bump-pointer arena for per-request allocations
+ *
+ * 요청 하나를 처리하는 동안 필요한 문자열(URI, host, port, path)과 헤더 버퍼를
+ * 블록 안에서 포인터만 밀어 가며 잘라 준다. 개별 해제는 없고, 요청이 끝나면
+ * arena_reset으로 한 번에 비운다.
+ *  - 첫 블록은 reset 후에도 남겨 두므로 평소에는 요청마다 malloc을 하지 않는다
+ *    (워커 스레드끼리 malloc 락을 다투지 않고, 큰 배열을 스택에 두지 않아도 된다).
+ *  - 블록이 모자라면 새 블록을 이어 붙이고, 그 블록들은 reset 때 해제한다.
+ *  - 스레드 하나가 자기 arena만 쓴다고 가정하므로 락이 없다.
+ */
+#include "arena.h"
+
+static void *new_block(arena_t *a, size_t size);
+
+void arena_init(arena_t *a, size_t blocksize)
+{
+    a->first = a->cur = NULL;
+    a->ptr = a->end = NULL;
+    a->blocksize = blocksize;
+}
+
+/* arena_alloc - size bytes aligned to ARENA_ALIGN; exits like Malloc on failure */
+void *arena_alloc(arena_t *a, size_t size)
+{
+    char *p;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if ((size_t)(a->end - a->ptr) < size)
+        return new_block(a, size);
+    p = a->ptr;
+    a->ptr += size;
+    return p;
+}
+
+char *arena_strndup(arena_t *a, const char *s, size_t n)
+{
+    char *p = arena_alloc(a, n + 1);
+
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+char *arena_strdup(arena_t *a, const char *s)
+{
+    return arena_strndup(a, s, strlen(s));
+}
+
+//arena_reset - 모든 할당을 한 번에 버린다. 첫 블록만 남기고 나머지 블록은 해제
+void arena_reset(arena_t *a)
+{
+    arena_block_t *b, *next;
+
+    if (!a->first)
+        return;
+    for (b = a->first->next; b; b = next) {
+        next = b->next;
+        Free(b);
+    }
+    a->first->next = NULL;
+    a->cur = a->first;
+    a->ptr = a->first->data;
+    a->end = a->first->data + a->first->size;
+}
+
+void arena_free(arena_t *a)
+{
+    arena_reset(a);
+    Free(a->first);
+    arena_init(a, a->blocksize);
+}
+
+/*
+ * new_block - Chain a block with room for size bytes after cur and
+ *     allocate from it. Requests larger than blocksize get a block of
+ *     their own.
+ */
+static void *new_block(arena_t *a, size_t size)
+{
+    arena_block_t *b;
+    size_t bsize = size > a->blocksize ? size : a->blocksize;
+
+    b = Malloc(sizeof(arena_block_t) + bsize);
+    b->size = bsize;
+    b->next = NULL;
+    if (a->cur)
+        a->cur->next = b;
+    else
+        a->first = b;
+    a->cur = b;
+    a->ptr = b->data + size;
+    a->end = b->data + bsize;
+    return b->data;
+}
@@ -0,0 +1,31 @@
+/*
+ * arena.h - Bump-pointer arena for per-request allocations
+ */
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "csapp.h"
+
+#define ARENA_ALIGN 16  /* Every allocation is aligned to this */
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;                  /* Usable bytes in data */
+    char data[];
+} arena_block_t;
+
+typedef struct {
+    arena_block_t *first;         /* Kept across arena_reset */
+    arena_block_t *cur;           /* Block being carved */
+    char *ptr, *end;              /* Free space in cur */
+    size_t blocksize;             /* Size of a regular block */
+} arena_t;
+
+void arena_init(arena_t *a, size_t blocksize);
+void *arena_alloc(arena_t *a, size_t size);
+char *arena_strdup(arena_t *a, const char *s);
+char *arena_strndup(arena_t *a, const char *s, size_t n);
+void arena_reset(arena_t *a);
+void arena_free(arena_t *a);
+
+#endif /* __ARENA_H__ */
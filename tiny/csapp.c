@@ -55,6 +55,19 @@ void app_error(char *msg) /* Application error */
 }
 /* $end errorfuns */
 
+void unix_warning(char *msg) /* Unix-style error, without exiting */
+{
+    int olderrno = errno;
+
+    fprintf(stderr, "%s: %s\n", msg, strerror(olderrno));
+    errno = olderrno;
+}
+
+void gai_warning(int code, char *msg) /* Getaddrinfo-style error, without exiting */
+{
+    fprintf(stderr, "%s: %s\n", msg, gai_strerror(code));
+}
+
 void dns_error(char *msg) /* Obsolete gethostbyname error */
 {
     fprintf(stderr, "%s\n", msg);
@@ -358,6 +371,7 @@ void Close(int fd)
 {
     int rc;
 
+    rio_flush(fd); /* Deferred rio writes go out before the close */
     if ((rc = close(fd)) < 0)
 	unix_error("Close error");
 }
@@ -742,6 +756,33 @@ void V(sem_t *sem)
  * The Rio package - Robust I/O functions
  ****************************************/
 
+/*
+ * rio_backend - Where the rio functions do their I/O. NULL means the
+ *     plain read/write/writev system calls; rio_set_backend installs
+ *     another implementation with the same semantics (see rio_uring.c).
+ *     A backend may defer writes; rio_flush(fd) and Close push them out.
+ */
+static rio_backend_t *rio_backend;
+
+#define RIO_READ(fd, buf, n) \
+    (rio_backend ? rio_backend->read(fd, buf, n) : read(fd, buf, n))
+#define RIO_WRITE(fd, buf, n) \
+    (rio_backend ? rio_backend->write(fd, buf, n) : write(fd, buf, n))
+#define RIO_WRITEV(fd, iov, iovcnt) \
+    (rio_backend ? rio_backend->writev(fd, iov, iovcnt) : writev(fd, iov, iovcnt))
+
+/* rio_set_backend - Call before any rio I/O, while single-threaded */
+void rio_set_backend(rio_backend_t *b)
+{
+    rio_backend = b;
+}
+
+/* rio_flush - Wait until deferred writes to fd are done; -1 if one failed */
+int rio_flush(int fd)
+{
+    return rio_backend ? rio_backend->flush(fd) : 0;
+}
+
 /*
  * rio_readn - Robustly read n bytes (unbuffered)
  */
@@ -753,7 +794,7 @@ ssize_t rio_readn(int fd, void *usrbuf, size_t n)
     char *bufp = usrbuf;
 
     while (nleft > 0) {
-	if ((nread = read(fd, bufp, nleft)) < 0) {
+	if ((nread = RIO_READ(fd, bufp, nleft)) < 0) {
 	    if (errno == EINTR) /* Interrupted by sig handler return */
 		nread = 0;      /* and call read() again */
 	    else
@@ -779,7 +820,7 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
     char *bufp = usrbuf;
 
     while (nleft > 0) {
-	if ((nwritten = write(fd, bufp, nleft)) <= 0) {
+	if ((nwritten = RIO_WRITE(fd, bufp, nleft)) <= 0) {
 	    if (errno == EINTR)  /* Interrupted by sig handler return */
 		nwritten = 0;    /* and call write() again */
 	    else
@@ -792,6 +833,64 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 }
 /* $end rio_writen */
 
+/*
+ * rio_writev - Robustly write iovcnt buffers with writev (unbuffered).
+ *    Short writes and EINTR are retried like rio_writen; iov is
+ *    advanced in place as data goes out.
+ */
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    size_t total = 0;
+    ssize_t nwritten;
+
+    while (iovcnt > 0) {
+	if ((nwritten = RIO_WRITEV(fd, iov, iovcnt)) < 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		nwritten = 0;    /* and call writev() again */
+	    else
+		return -1;       /* errno set by writev() */
+	}
+	total += nwritten;
+	while (iovcnt > 0 && (size_t)nwritten >= iov->iov_len) {
+	    nwritten -= iov->iov_len;   /* Skip buffers fully written */
+	    iov++;
+	    iovcnt--;
+	}
+	if (iovcnt > 0) {               /* Resume inside a partial one */
+	    iov->iov_base = (char *)iov->iov_base + nwritten;
+	    iov->iov_len -= nwritten;
+	}
+    }
+    return total;
+}
+
+/*
+ * rio_sendfile - Robustly send count bytes of infd to outfd with
+ *     sendfile (unbuffered), starting at *offset, or at the file
+ *     position if offset is NULL. Returns the bytes sent, which is less
+ *     than count only if the file ended first, or -1 with errno set
+ *     (EINVAL: these descriptors can't be used with sendfile).
+ */
+ssize_t rio_sendfile(int outfd, int infd, off_t *offset, size_t count)
+{
+    size_t nleft = count;
+    ssize_t nsent;
+
+    if (rio_flush(outfd) < 0) /* Deferred rio writes go first */
+	return -1;
+    while (nleft > 0) {
+	if ((nsent = sendfile(outfd, infd, offset, nleft)) < 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		nsent = 0;       /* and call sendfile() again */
+	    else
+		return -1;       /* errno set by sendfile() */
+	}
+	else if (nsent == 0)
+	    break;               /* EOF: the file is shorter than count */
+	nleft -= nsent;
+    }
+    return count - nleft;
+}
 
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
@@ -807,8 +906,8 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
     int cnt;
 
     while (rp->rio_cnt <= 0) {  /* Refill if buf is empty */
-	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
-			   sizeof(rp->rio_buf));
+	rp->rio_cnt = RIO_READ(rp->rio_fd, rp->rio_buf, 
+			   rp->rio_bufsize);
 	if (rp->rio_cnt < 0) {
 	    if (errno != EINTR) /* Interrupted by sig handler return */
 		return -1;
@@ -831,16 +930,121 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 /* $end rio_read */
 
 /*
- * rio_readinitb - Associate a descriptor with a read buffer and reset buffer
+ * Rio buffer pool - Internal buffers come from per-size-class (power of
+ *    two) free lists. Buffers returned by rio_release are reused by the
+ *    next connection; up to RIO_POOLMAX are kept per class. The first
+ *    word of a free buffer links the list.
+ */
+#define RIO_NCLASSES 11         /* 1KB, 2KB, ..., 1MB */
+#define RIO_POOLMAX 64          /* Free buffers kept per class */
+
+static char *rio_freelist[RIO_NCLASSES];
+static int rio_nfree[RIO_NCLASSES];
+static sem_t rio_pool_mutex;
+static pthread_once_t rio_pool_once = PTHREAD_ONCE_INIT;
+
+static void rio_pool_init(void)
+{
+    Sem_init(&rio_pool_mutex, 0, 1);
+}
+
+/* Size class holding at least size bytes; *bufsize gets its size */
+static int rio_class(size_t size, size_t *bufsize)
+{
+    int c = 0;
+
+    for (*bufsize = RIO_MINBUFSIZE; *bufsize < size && c < RIO_NCLASSES - 1; c++)
+	*bufsize <<= 1;
+    return c;
+}
+
+static char *rio_buf_get(size_t size, size_t *bufsize)
+{
+    int c = rio_class(size, bufsize);
+    char *buf;
+
+    Pthread_once(&rio_pool_once, rio_pool_init);
+    P(&rio_pool_mutex);
+    if ((buf = rio_freelist[c]) != NULL) {
+	rio_freelist[c] = *(char **)buf;
+	rio_nfree[c]--;
+    }
+    V(&rio_pool_mutex);
+    return buf ? buf : Malloc(*bufsize);
+}
+
+static void rio_buf_put(char *buf, size_t bufsize)
+{
+    size_t size;
+    int c = rio_class(bufsize, &size);
+
+    P(&rio_pool_mutex);
+    if (rio_nfree[c] < RIO_POOLMAX) {
+	*(char **)buf = rio_freelist[c];
+	rio_freelist[c] = buf;
+	rio_nfree[c]++;
+	buf = NULL;
+    }
+    V(&rio_pool_mutex);
+    free(buf);
+}
+
+/*
+ * rio_readinitb - Associate a descriptor with a read buffer of the
+ *    default size (RIO_BUFSIZE) and reset buffer. Release the buffer
+ *    with rio_release when done.
  */
 /* $begin rio_readinitb */
 void rio_readinitb(rio_t *rp, int fd) 
+{
+    rio_readinitb_sz(rp, fd, RIO_BUFSIZE);
+}
+/* $end rio_readinitb */
+
+/*
+ * rio_readinitb_sz - rio_readinitb with a buffer of at least size bytes
+ */
+void rio_readinitb_sz(rio_t *rp, int fd, size_t size)
 {
     rp->rio_fd = fd;  
     rp->rio_cnt = 0;  
+    rp->rio_buf = rio_buf_get(size, &rp->rio_bufsize);
     rp->rio_bufptr = rp->rio_buf;
 }
-/* $end rio_readinitb */
+
+/*
+ * rio_resize - Switch rp to a buffer of at least size bytes, keeping the
+ *     unread bytes. Returns 0, or -1 (buffer unchanged) if they don't fit.
+ */
+int rio_resize(rio_t *rp, size_t size)
+{
+    size_t bufsize;
+    char *buf;
+
+    rio_class(size, &bufsize);
+    if (bufsize == rp->rio_bufsize)
+	return 0;
+    if (rp->rio_cnt > 0 && (size_t)rp->rio_cnt > bufsize)
+	return -1;
+    buf = rio_buf_get(size, &bufsize);
+    if (rp->rio_cnt > 0)
+	memcpy(buf, rp->rio_bufptr, rp->rio_cnt);
+    rio_buf_put(rp->rio_buf, rp->rio_bufsize);
+    rp->rio_buf = rp->rio_bufptr = buf;
+    rp->rio_bufsize = bufsize;
+    return 0;
+}
+
+/*
+ * rio_release - Return rp's buffer to the pool
+ */
+void rio_release(rio_t *rp)
+{
+    if (rp->rio_buf)
+	rio_buf_put(rp->rio_buf, rp->rio_bufsize);
+    rp->rio_buf = rp->rio_bufptr = NULL;
+    rp->rio_cnt = 0;
+}
 
 /*
  * rio_readnb - Robustly read n bytes (buffered)
@@ -870,26 +1074,37 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
-
-    for (n = 1; n < maxlen; n++) { 
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-	    *bufp++ = c;
-	    if (c == '\n') {
-                n++;
-     		break;
-            }
-	} else if (rc == 0) {
-	    if (n == 1)
-		return 0; /* EOF, no data read */
-	    else
-		break;    /* EOF, some data was read */
-	} else
-	    return -1;	  /* Error */
+    size_t n, cnt;
+    ssize_t rc;
+    char *bufp = usrbuf, *nl;
+
+    for (n = 0; n + 1 < maxlen; ) {
+        if (rp->rio_cnt <= 0) {      /* Refill, taking the first byte */
+            if ((rc = rio_read(rp, bufp, 1)) < 0)
+                return -1;      /* Error */
+            if (rc == 0)
+                break;          /* EOF */
+            n++;
+            if (*bufp++ == '\n')
+                break;
+            continue;
+        }
+        /* Copy up to and including the next newline in one go */
+        cnt = maxlen - 1 - n;
+        if (rp->rio_cnt < cnt)
+            cnt = rp->rio_cnt;
+        if ((nl = memchr(rp->rio_bufptr, '\n', cnt)))
+            cnt = nl - rp->rio_bufptr + 1;
+        memcpy(bufp, rp->rio_bufptr, cnt);
+        rp->rio_bufptr += cnt;
+        rp->rio_cnt -= cnt;
+        bufp += cnt;
+        n += cnt;
+        if (nl)
+            break;
     }
     *bufp = 0;
-    return n-1;
+    return n;
 }
 /* $end rio_readlineb */
 
@@ -911,6 +1126,12 @@ void Rio_writen(int fd, void *usrbuf, size_t n)
 	unix_error("Rio_writen error");
 }
 
+void Rio_writev(int fd, struct iovec *iov, int iovcnt) 
+{
+    if (rio_writev(fd, iov, iovcnt) < 0)
+	unix_error("Rio_writev error");
+}
+
 void Rio_readinitb(rio_t *rp, int fd)
 {
     rio_readinitb(rp, fd);
@@ -995,6 +1216,24 @@ int open_clientfd(char *hostname, char *port) {
  */
 /* $begin open_listenfd */
 int open_listenfd(char *port) 
+{
+    return open_listenfd_ex(port, LISTENQ, 0);
+}
+/* $end open_listenfd */
+
+/*
+ * open_listenfd_ex - open_listenfd with a listen() backlog (LISTENQ if
+ *     backlog <= 0) and LISTEN_* flags:
+ *       LISTEN_REUSEPORT  set SO_REUSEPORT, so each worker thread or
+ *                         process can open its own listener on port
+ *       LISTEN_DEFER_ACCEPT  set TCP_DEFER_ACCEPT: accept() returns a
+ *                         connection only once its first data has
+ *                         arrived (or after LISTEN_DEFER_SECS)
+ *       LISTEN_FASTOPEN   set TCP_FASTOPEN with a queue of backlog, so
+ *                         returning clients can send the request in
+ *                         the SYN
+ */
+int open_listenfd_ex(char *port, int backlog, int flags)
 {
     struct addrinfo hints, *listp, *p;
     int listenfd, rc, optval=1;
@@ -1019,6 +1258,14 @@ int open_listenfd(char *port)
         setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,    //line:netp:csapp:setsockopt
                    (const void *)&optval , sizeof(int));
 
+        /* Let several listeners share the port; the kernel balances accepts */
+        if ((flags & LISTEN_REUSEPORT) &&
+            setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+                       (const void *)&optval, sizeof(int)) < 0) {
+            close(listenfd);
+            continue;
+        }
+
         /* Bind the descriptor to the address */
         if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0)
             break; /* Success */
@@ -1034,14 +1281,26 @@ int open_listenfd(char *port)
     if (!p) /* No address worked */
         return -1;
 
+    /* Both are hints: a kernel that refuses them still gets a listener */
+    if (flags & LISTEN_DEFER_ACCEPT) {
+        optval = LISTEN_DEFER_SECS;
+        setsockopt(listenfd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                   (const void *)&optval, sizeof(int));
+    }
+    if (flags & LISTEN_FASTOPEN) {
+        optval = backlog > 0 ? backlog : LISTENQ;
+        setsockopt(listenfd, IPPROTO_TCP, TCP_FASTOPEN,
+                   (const void *)&optval, sizeof(int));
+    }
+
     /* Make it a listening socket ready to accept connection requests */
-    if (listen(listenfd, LISTENQ) < 0) {
+    if (listen(listenfd, backlog > 0 ? backlog : LISTENQ) < 0) {
         close(listenfd);
 	return -1;
     }
     return listenfd;
 }
-/* $end open_listenfd */
+/* $end open_listenfd_ex */
 
 /****************************************************
  * Wrappers for reentrant protocol-independent helpers
@@ -1064,6 +1323,110 @@ int Open_listenfd(char *port)
     return rc;
 }
 
+int Open_listenfd_ex(char *port, int backlog, int flags) 
+{
+    int rc;
+
+    if ((rc = open_listenfd_ex(port, backlog, flags)) < 0)
+	unix_error("Open_listenfd error");
+    return rc;
+}
+
+/****************************************************
+ * Non-terminating wrappers for long-running servers
+ ****************************************************/
+/*
+ * The _e wrappers report errors the way the wrappers above do, but
+ * return instead of exiting: -1 with errno set (Getnameinfo_e returns
+ * the getaddrinfo-style code). Use them for anything a peer can make
+ * fail, so one reset connection only ends its own transaction.
+ */
+/* $begin server_init */
+/*
+ * Server_init - Process-wide setup for a long-running server. Writing
+ *     to a socket the peer has reset raises SIGPIPE, whose default
+ *     action kills the process; ignore it so the write returns EPIPE.
+ */
+void Server_init(void)
+{
+    Signal(SIGPIPE, SIG_IGN);
+}
+/* $end server_init */
+
+int Accept_e(int s, struct sockaddr *addr, socklen_t *addrlen) 
+{
+    int rc;
+
+    if ((rc = accept(s, addr, addrlen)) < 0)
+	unix_warning("Accept error");
+    return rc;
+}
+
+int Getnameinfo_e(const struct sockaddr *sa, socklen_t salen, char *host, 
+                  size_t hostlen, char *serv, size_t servlen, int flags)
+{
+    int rc;
+
+    if ((rc = getnameinfo(sa, salen, host, hostlen, serv, 
+                          servlen, flags)) != 0) 
+        gai_warning(rc, "Getnameinfo error");
+    return rc;
+}
+
+int Open_clientfd_e(char *hostname, char *port) 
+{
+    int rc;
+
+    if ((rc = open_clientfd(hostname, port)) < 0) 
+	unix_warning("Open_clientfd error");
+    return rc;
+}
+
+ssize_t Rio_readn_e(int fd, void *ptr, size_t nbytes) 
+{
+    ssize_t n;
+  
+    if ((n = rio_readn(fd, ptr, nbytes)) < 0)
+	unix_warning("Rio_readn error");
+    return n;
+}
+
+ssize_t Rio_writen_e(int fd, void *usrbuf, size_t n) 
+{
+    ssize_t rc;
+
+    if ((rc = rio_writen(fd, usrbuf, n)) < 0)
+	unix_warning("Rio_writen error");
+    return rc;
+}
+
+ssize_t Rio_writev_e(int fd, struct iovec *iov, int iovcnt) 
+{
+    ssize_t rc;
+
+    if ((rc = rio_writev(fd, iov, iovcnt)) < 0)
+	unix_warning("Rio_writev error");
+    return rc;
+}
+
+ssize_t Rio_readnb_e(rio_t *rp, void *usrbuf, size_t n) 
+{
+    ssize_t rc;
+
+    if ((rc = rio_readnb(rp, usrbuf, n)) < 0)
+	unix_warning("Rio_readnb error");
+    return rc;
+}
+
+ssize_t Rio_readlineb_e(rio_t *rp, void *usrbuf, size_t maxlen) 
+{
+    ssize_t rc;
+
+    if ((rc = rio_readlineb(rp, usrbuf, maxlen)) < 0)
+	unix_warning("Rio_readlineb error");
+    return rc;
+} 
+
 /* $end csapp.c */
 
 
@@ -25,8 +25,12 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <arpa/inet.h>
 
 /* Default file permissions are DEF_MODE & ~DEF_UMASK */
@@ -42,15 +46,26 @@ typedef struct sockaddr SA;
 
 /* Persistent state for the robust I/O (Rio) package */
 /* $begin rio_t */
-#define RIO_BUFSIZE 8192
+#define RIO_BUFSIZE 8192        /* Default size for rio_readinitb */
+#define RIO_MINBUFSIZE 1024     /* Buffer sizes are rounded up to a power of */
+#define RIO_MAXBUFSIZE (1 << 20) /* two in [RIO_MINBUFSIZE, RIO_MAXBUFSIZE] */
 typedef struct {
     int rio_fd;                /* Descriptor for this internal buf */
     int rio_cnt;               /* Unread bytes in internal buf */
     char *rio_bufptr;          /* Next unread byte in internal buf */
-    char rio_buf[RIO_BUFSIZE]; /* Internal buffer */
+    char *rio_buf;             /* Internal buffer, borrowed from a pool */
+    size_t rio_bufsize;        /* Size of rio_buf */
 } rio_t;
 /* $end rio_t */
 
+/* I/O functions behind the rio package (rio_set_backend) */
+typedef struct {
+    ssize_t (*read)(int fd, void *buf, size_t n);
+    ssize_t (*write)(int fd, void *buf, size_t n);
+    ssize_t (*writev)(int fd, struct iovec *iov, int iovcnt);
+    int (*flush)(int fd);
+} rio_backend_t;
+
 /* External variables */
 extern int h_errno;    /* Defined by BIND for DNS errors */ 
 extern char **environ; /* Defined by libc */
@@ -59,6 +74,10 @@ extern char **environ; /* Defined by libc */
 #define	MAXLINE	 8192  /* Max text line length */
 #define MAXBUF   8192  /* Max I/O buffer size */
 #define LISTENQ  1024  /* Second argument to listen() */
+#define LISTEN_REUSEPORT 0x1  /* open_listenfd_ex: one SO_REUSEPORT listener per worker */
+#define LISTEN_DEFER_ACCEPT 0x2  /* open_listenfd_ex: accept only once the request has arrived */
+#define LISTEN_FASTOPEN  0x4  /* open_listenfd_ex: TCP Fast Open, data in the SYN */
+#define LISTEN_DEFER_SECS 5   /* TCP_DEFER_ACCEPT timeout */
 
 /* Our own error-handling functions */
 void unix_error(char *msg);
@@ -66,6 +85,8 @@ void posix_error(int code, char *msg);
 void dns_error(char *msg);
 void gai_error(int code, char *msg);
 void app_error(char *msg);
+void unix_warning(char *msg);
+void gai_warning(int code, char *msg);
 
 /* Process control wrappers */
 pid_t Fork(void);
@@ -175,13 +196,21 @@ void V(sem_t *sem);
 /* Rio (Robust I/O) package */
 ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, void *usrbuf, size_t n);
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt);
+ssize_t rio_sendfile(int outfd, int infd, off_t *offset, size_t count);
+void rio_set_backend(rio_backend_t *b);
+int rio_flush(int fd);
 void rio_readinitb(rio_t *rp, int fd); 
+void rio_readinitb_sz(rio_t *rp, int fd, size_t size);
+int rio_resize(rio_t *rp, size_t size);
+void rio_release(rio_t *rp);
 ssize_t	rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t	rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
 
 /* Wrappers for Rio package */
 ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
 void Rio_writen(int fd, void *usrbuf, size_t n);
+void Rio_writev(int fd, struct iovec *iov, int iovcnt);
 void Rio_readinitb(rio_t *rp, int fd); 
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
@@ -189,10 +218,27 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
 /* Reentrant protocol-independent client/server helpers */
 int open_clientfd(char *hostname, char *port);
 int open_listenfd(char *port);
+int open_listenfd_ex(char *port, int backlog, int flags);
+
+/* accept4 is only declared under _GNU_SOURCE, which clashes with gai_error */
+extern int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
 
 /* Wrappers for reentrant protocol-independent client/server helpers */
 int Open_clientfd(char *hostname, char *port);
 int Open_listenfd(char *port);
+int Open_listenfd_ex(char *port, int backlog, int flags);
+
+/* Non-terminating wrappers: print like the ones above, return instead of exiting */
+void Server_init(void);
+int Accept_e(int s, struct sockaddr *addr, socklen_t *addrlen);
+int Getnameinfo_e(const struct sockaddr *sa, socklen_t salen, char *host, 
+                  size_t hostlen, char *serv, size_t servlen, int flags);
+int Open_clientfd_e(char *hostname, char *port);
+ssize_t Rio_readn_e(int fd, void *usrbuf, size_t n);
+ssize_t Rio_writen_e(int fd, void *usrbuf, size_t n);
+ssize_t Rio_writev_e(int fd, struct iovec *iov, int iovcnt);
+ssize_t Rio_readnb_e(rio_t *rp, void *usrbuf, size_t n);
+ssize_t Rio_readlineb_e(rio_t *rp, void *usrbuf, size_t maxlen);
 
 
 #endif /* __CSAPP_H__ */
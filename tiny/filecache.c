@@ -0,0 +1,214 @@
+/*
+ * filecache.c - LRU cache of static files and their response headers
+ *
+ * 경로(filename)로 찾는 해시 테이블과 LRU 이중 연결 리스트. 객체 하나에
+ * 미리 만들어 둔 응답 헤드(Connection 줄은 연결마다 달라서 뺀다)와 파일 내용을
+ * 이어 붙여 두므로 히트는 writev 한 번으로 끝나고 stat/open/read/close가 없다.
+ *  - 히트 때 파일이 바뀌었는지는 FCACHE_RECHECK_MS에 한 번만 stat으로
+ *    확인한다 (st_mtim과 st_size 비교). 바뀌었거나 사라졌으면 객체를 버리고
+ *    미스로 처리 -> 호출한 쪽이 파일을 다시 읽어 넣는다.
+ *  - 내용 합계가 budget을 넘으면 LRU 꼬리부터 교체한다.
+ *  - budget이 0이면 아무것도 넣지 않는다 (캐시 끔).
+ * 스레드 풀 모드에서는 워커들이 함께 쓰므로 테이블과 리스트는 mutex 하나로 보호한다.
+ * 객체는 참조 카운트로 관리한다. 워커는 찾은 객체를 pin한 채 락 없이 클라이언트에
+ * 쓰고, 그 사이에 교체된 객체는 마지막 fcache_release에서 해제된다.
+ */
+#include "filecache.h"
+
+#define NBUCKETS 1024  /* Hash buckets (power of 2) */
+
+static fcache_obj_t *buckets[NBUCKETS];
+static fcache_obj_t *lru_head, *lru_tail;  /* Most / least recently used */
+static size_t cache_size;                  /* Bytes of data in the cache */
+static size_t cache_budget;
+static unsigned long nhits, nmisses, nstale, nevicts;
+static sem_t mutex;                        /* Protects all of the above */
+
+static unsigned hash(const char *s);
+static unsigned long now_ms(void);
+static void remove_obj(fcache_obj_t *obj);
+static void lru_unlink(fcache_obj_t *obj);
+static void lru_push(fcache_obj_t *obj);
+
+void fcache_init(size_t budget)
+{
+    cache_budget = budget;
+    Sem_init(&mutex, 0, 1);
+}
+
+//fcache_cacheable - filesize 바이트 파일을 캐시에 넣을 수 있는지 (넣기 전에 메모리로 읽을지 결정)
+int fcache_cacheable(size_t filesize)
+{
+    return filesize <= FCACHE_MAX_OBJECT && filesize < cache_budget;
+}
+
+/*
+ * fcache_find - Return the object for path, or NULL on a miss. A hit
+ *     older than FCACHE_RECHECK_MS is revalidated with stat and dropped
+ *     if the file is gone, no longer readable, or its mtime or size
+ *     changed. A returned object is pinned; call fcache_release when
+ *     done with it.
+ */
+fcache_obj_t *fcache_find(const char *path)
+{
+    fcache_obj_t *obj;
+    struct stat sbuf;
+    unsigned long now;
+
+    P(&mutex);
+    for (obj = buckets[hash(path) % NBUCKETS]; obj; obj = obj->hnext)
+        if (!strcmp(obj->path, path))
+            break;
+    if (!obj) {
+        nmisses++;
+        V(&mutex);
+        return NULL;
+    }
+
+    now = now_ms();
+    if (now - obj->checked >= FCACHE_RECHECK_MS) {
+        if (stat(path, &sbuf) < 0 || !S_ISREG(sbuf.st_mode) ||
+            !(S_IRUSR & sbuf.st_mode) || sbuf.st_size != obj->st_size ||
+            sbuf.st_mtim.tv_sec != obj->st_mtim.tv_sec ||
+            sbuf.st_mtim.tv_nsec != obj->st_mtim.tv_nsec) {
+            remove_obj(obj);
+            nstale++;
+            nmisses++;
+            V(&mutex);
+            return NULL;
+        }
+        obj->checked = now;
+    }
+    lru_unlink(obj);
+    lru_push(obj);
+    __sync_fetch_and_add(&obj->refcnt, 1);
+    nhits++;
+    V(&mutex);
+    return obj;
+}
+
+//fcache_release - fcache_find로 얻은 참조를 반납. 이미 교체된 객체면 마지막 참조가 해제한다.
+void fcache_release(fcache_obj_t *obj)
+{
+    if (__sync_sub_and_fetch(&obj->refcnt, 1) == 0) {
+        Free(obj->path);
+        Free(obj->data);
+        Free(obj);
+    }
+}
+
+/*
+ * fcache_insert - Cache data (size bytes: hdr_len of response head, then
+ *     the file) for path, as of sbuf. On success the cache owns data,
+ *     which must come from Malloc, and 1 is returned; on 0 the caller
+ *     still owns it. Replaces any object already cached for path.
+ */
+int fcache_insert(const char *path, const struct stat *sbuf, char *data,
+                  size_t hdr_len, size_t size)
+{
+    fcache_obj_t *obj, **bucket = &buckets[hash(path) % NBUCKETS];
+
+    if (size > cache_budget)
+        return 0;
+    P(&mutex);
+    for (obj = *bucket; obj; obj = obj->hnext)
+        if (!strcmp(obj->path, path)) {
+            remove_obj(obj);
+            break;
+        }
+    while (cache_size + size > cache_budget) {
+        remove_obj(lru_tail);
+        nevicts++;
+    }
+
+    obj = Malloc(sizeof(fcache_obj_t));
+    obj->path = Malloc(strlen(path) + 1);
+    strcpy(obj->path, path);
+    obj->data = data;
+    obj->hdr_len = hdr_len;
+    obj->size = size;
+    obj->refcnt = 1;                 /* The cache's own reference */
+    obj->st_size = sbuf->st_size;
+    obj->st_mtim = sbuf->st_mtim;
+    obj->checked = now_ms();
+    obj->hnext = *bucket;
+    *bucket = obj;
+    lru_push(obj);
+    cache_size += size;
+    V(&mutex);
+    return 1;
+}
+
+//fcache_print_stats - 히트/미스 카운터 출력 (시그널 핸들러에서 호출 가능)
+void fcache_print_stats(void)
+{
+    sio_puts("filecache: hits ");
+    sio_putl(nhits);
+    sio_puts(" misses ");
+    sio_putl(nmisses);
+    sio_puts(" stale ");
+    sio_putl(nstale);
+    sio_puts(" evictions ");
+    sio_putl(nevicts);
+    sio_puts(" bytes ");
+    sio_putl(cache_size);
+    sio_puts("\n");
+}
+
+/* remove_obj - Unlink obj from the hash chain and LRU list and drop the
+ *     cache's reference; caller holds mutex */
+static void remove_obj(fcache_obj_t *obj)
+{
+    fcache_obj_t **pp;
+
+    for (pp = &buckets[hash(obj->path) % NBUCKETS]; *pp != obj; pp = &(*pp)->hnext)
+        ;
+    *pp = obj->hnext;
+    lru_unlink(obj);
+    cache_size -= obj->size;
+    fcache_release(obj);        /* Freed now unless a sender still holds it */
+}
+
+/* FNV-1a string hash */
+static unsigned hash(const char *s)
+{
+    unsigned h = 2166136261u;
+
+    while (*s)
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+/* Coarse monotonic clock: read through the vDSO, so a hit makes no syscall */
+static unsigned long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+/* LRU list helpers */
+static void lru_unlink(fcache_obj_t *obj)
+{
+    if (obj->prev)
+        obj->prev->next = obj->next;
+    else
+        lru_head = obj->next;
+    if (obj->next)
+        obj->next->prev = obj->prev;
+    else
+        lru_tail = obj->prev;
+    obj->prev = obj->next = NULL;
+}
+
+static void lru_push(fcache_obj_t *obj)
+{
+    obj->prev = NULL;
+    obj->next = lru_head;
+    if (lru_head)
+        lru_head->prev = obj;
+    else
+        lru_tail = obj;
+    lru_head = obj;
+}
@@ -0,0 +1,34 @@
+/*
+ * filecache.h - LRU cache of static files and their response headers
+ */
+#ifndef __FILECACHE_H__
+#define __FILECACHE_H__
+
+#include "csapp.h"
+
+#define FCACHE_SIZE       (16*1024*1024)  /* Default byte budget (-c) */
+#define FCACHE_MAX_OBJECT (256*1024)      /* Larger files go out with sendfile */
+#define FCACHE_RECHECK_MS 1000            /* Least time between stats of a hit */
+
+typedef struct fcache_obj {
+    char *path;                      /* Key: file name as given to stat */
+    char *data;                      /* Response head, less Connection, then the file */
+    size_t hdr_len;                  /* Bytes of head in data; Connection goes here */
+    size_t size;                     /* Bytes in data */
+    int refcnt;                      /* Cache's reference + senders in flight */
+    off_t st_size;                   /* st_size when loaded */
+    struct timespec st_mtim;         /* st_mtim when loaded */
+    unsigned long checked;           /* Time of last stat (ms) */
+    struct fcache_obj *hnext;        /* Next object in hash chain */
+    struct fcache_obj *prev, *next;  /* LRU list, most recently used first */
+} fcache_obj_t;
+
+void fcache_init(size_t budget);
+int fcache_cacheable(size_t filesize);
+fcache_obj_t *fcache_find(const char *path);
+void fcache_release(fcache_obj_t *obj);
+int fcache_insert(const char *path, const struct stat *sbuf, char *data,
+                  size_t hdr_len, size_t size);
+void fcache_print_stats(void);
+
+#endif /* __FILECACHE_H__ */
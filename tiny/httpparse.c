@@ -0,0 +1,211 @@
+/*
+ * httpparse.c - Vectorized parser for HTTP request heads
+ *
+ * 요청 헤드 전체(요청 라인 + 헤더 + 빈 줄)를 한 번에 받아 method / URI / version과
+ * 헤더 배열로 나눈다. 모든 필드는 수신 버퍼 안을 가리키고(복사 없음), 헤드가 끝까지
+ * 있을 때만 각 필드 끝에 '\0'을 써서 C 문자열로도 쓸 수 있게 한다.
+ *  - 구분 문자(' ', ':', CR/LF)는 SSE2로 16바이트, AVX2로 32바이트씩 한 번에 비교해서 찾는다.
+ *  - AVX2는 시작할 때 __builtin_cpu_supports로 확인하고, x86-64가 아니면 스칼라 버전을 쓴다.
+ *  - 줄 끝은 CRLF와 LF 모두 받아들인다.
+ */
+#include <string.h>
+#include <strings.h>
+#include "httpparse.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/* Find the first a or b in [p, end); end if there is none */
+typedef const char *(*find_fn)(const char *p, const char *end, char a, char b);
+
+static const char *find_scalar(const char *p, const char *end, char a, char b);
+#if defined(__x86_64__)
+static const char *find_sse2(const char *p, const char *end, char a, char b);
+static const char *find_avx2(const char *p, const char *end, char a, char b);
+#endif
+
+static find_fn find2 = find_scalar;
+static const char *impl = "scalar";
+
+static int next_line(char *p, const char *end, char **eol, char **next);
+
+/* Pick the widest implementation this CPU runs, once at startup */
+__attribute__((constructor))
+static void httpparse_init(void)
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        find2 = find_avx2;
+        impl = "avx2";
+    }
+    else {
+        find2 = find_sse2;      /* Always there on x86-64 */
+        impl = "sse2";
+    }
+#endif
+}
+
+/*
+ * http_parse_request - Parse the request head at the start of buf.
+ *     Returns the length of the head (through the blank line), 0 if buf
+ *     ends before the head does, or -1 if the head is malformed.
+ *     Only headers up to HTTP_MAXHDRS are recorded.
+ */
+int http_parse_request(char *buf, size_t len, http_request_t *req)
+{
+    const char *end = buf + len;
+    char *p, *q, *eol, *next, *colon, *v, *e;
+    http_header_t *h;
+    int rc, i;
+
+    /* Request line: method SP uri SP version */
+    if ((rc = next_line(buf, end, &eol, &next)) <= 0)
+        return rc;
+    p = buf;
+    q = (char *)find2(p, eol, ' ', ' ');
+    if (q == p || q == eol)
+        return -1;
+    req->method = p;
+    req->method_len = q - p;
+    p = q + 1;
+    q = (char *)find2(p, eol, ' ', ' ');
+    if (q == p || q == eol)
+        return -1;
+    req->uri = p;
+    req->uri_len = q - p;
+    p = q + 1;
+    if (eol - p < 8 || strncmp(p, "HTTP/", 5))
+        return -1;
+    req->version = p;
+    req->version_len = eol - p;
+
+    /* Header lines up to the blank line */
+    req->nheaders = 0;
+    for (p = next; ; p = next) {
+        if ((rc = next_line(p, end, &eol, &next)) <= 0)
+            return rc;
+        if (eol == p)
+            break;
+        if (*p == ' ' || *p == '\t')    /* Obsolete line folding */
+            return -1;
+        colon = (char *)find2(p, eol, ':', ':');
+        if (colon == p || colon == eol)
+            return -1;
+        if (req->nheaders == HTTP_MAXHDRS)
+            continue;
+        for (v = colon + 1; v < eol && (*v == ' ' || *v == '\t'); v++)
+            ;
+        for (e = eol; e > v && (e[-1] == ' ' || e[-1] == '\t'); e--)
+            ;
+        h = &req->headers[req->nheaders++];
+        h->name = p;
+        h->name_len = colon - p;
+        h->value = v;
+        h->value_len = e - v;
+    }
+
+    //헤드가 완전할 때만 버퍼를 고친다 -> 덜 받은 헤드는 더 읽은 뒤 처음부터 다시 파싱할 수 있다
+    req->method[req->method_len] = '\0';
+    req->uri[req->uri_len] = '\0';
+    req->version[req->version_len] = '\0';
+    for (i = 0; i < req->nheaders; i++) {
+        req->headers[i].name[req->headers[i].name_len] = '\0';
+        req->headers[i].value[req->headers[i].value_len] = '\0';
+    }
+    return next - buf;
+}
+
+//http_header - 이름이 name인 (대소문자 무시) 첫 번째 헤더의 값, 없으면 NULL
+const char *http_header(const http_request_t *req, const char *name)
+{
+    int i;
+
+    for (i = 0; i < req->nheaders; i++)
+        if (!strcasecmp(req->headers[i].name, name))
+            return req->headers[i].value;
+    return NULL;
+}
+
+//http_parse_impl - 사용 중인 구현 이름 ("avx2", "sse2", "scalar")
+const char *http_parse_impl(void)
+{
+    return impl;
+}
+
+/*
+ * next_line - Find the end of the line starting at p: *eol is its CR or
+ *     LF and *next the start of the following line. Returns 1, 0 if the
+ *     line isn't complete yet, or -1 for a CR not followed by LF.
+ */
+static int next_line(char *p, const char *end, char **eol, char **next)
+{
+    char *e = (char *)find2(p, end, '\r', '\n');
+
+    if (e == end)
+        return 0;
+    if (*e == '\r') {
+        if (e + 1 == end)
+            return 0;
+        if (e[1] != '\n')
+            return -1;
+        *next = e + 2;
+    }
+    else
+        *next = e + 1;
+    *eol = e;
+    return 1;
+}
+
+static const char *find_scalar(const char *p, const char *end, char a, char b)
+{
+    for (; p < end; p++)
+        if (*p == a || *p == b)
+            return p;
+    return end;
+}
+
+#if defined(__x86_64__)
+static const char *find_sse2(const char *p, const char *end, char a, char b)
+{
+    __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b), v;
+    unsigned mask;
+
+    for (; end - p >= 16; p += 16) {
+        v = _mm_loadu_si128((const __m128i *)p);
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va),
+                                              _mm_cmpeq_epi8(v, vb)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return find_scalar(p, end, a, b);
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *p, const char *end, char a, char b)
+{
+    __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b), v;
+    unsigned mask;
+
+    for (; end - p >= 32; p += 32) {
+        v = _mm256_loadu_si256((const __m256i *)p);
+        mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va),
+                                                    _mm256_cmpeq_epi8(v, vb)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    //남은 0-31바이트도 여기서 처리한다 - VEX가 아닌 SSE 함수를 부르면 AVX-SSE 전환 비용이 든다
+    if (end - p >= 16) {
+        __m128i v16 = _mm_loadu_si128((const __m128i *)p);
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v16, _mm256_castsi256_si128(va)),
+                                              _mm_cmpeq_epi8(v16, _mm256_castsi256_si128(vb))));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    for (; p < end; p++)
+        if (*p == a || *p == b)
+            return p;
+    return end;
+}
+#endif
@@ -0,0 +1,29 @@
+/*
+ * httpparse.h - Vectorized parser for HTTP request heads
+ */
+#ifndef __HTTPPARSE_H__
+#define __HTTPPARSE_H__
+
+#include <stddef.h>
+
+#define HTTP_MAXHDRS 64  /* Headers kept per request; the rest are skipped */
+
+typedef struct {
+    char *name;                /* NUL-terminated, points into the buffer */
+    size_t name_len;
+    char *value;               /* Without leading/trailing blanks */
+    size_t value_len;
+} http_header_t;
+
+typedef struct {
+    char *method, *uri, *version;
+    size_t method_len, uri_len, version_len;
+    http_header_t headers[HTTP_MAXHDRS];
+    int nheaders;
+} http_request_t;
+
+int http_parse_request(char *buf, size_t len, http_request_t *req);
+const char *http_header(const http_request_t *req, const char *name);
+const char *http_parse_impl(void);
+
+#endif /* __HTTPPARSE_H__ */
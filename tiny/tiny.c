@@ -6,73 +6,337 @@
  * Updated 11/2019 droh
  *   - Fixed sprintf() aliasing issue in serve_static(), and clienterror().
  */
+#include <sys/prctl.h>
 #include "csapp.h"
-
-void doit(int fd);
-void read_requesthdrs(rio_t *rp);
+#include "httpparse.h"
+#include "arena.h"
+#include "filecache.h"
+#include "sbuf.h"
+
+#define ARENA_SIZE (16*1024)  /* Arena block for one request: head + file names */
+#define NWORKERS 4            /* Default worker threads / processes (-t) */
+#define SBUFSIZE 16           /* Default connection queue slots (-e thread) */
+#define KEEPALIVE_TIMEOUT 5   /* Seconds to wait for a client's next request */
+#define KEEPALIVE_MAX 100     /* Requests served on one connection (-k) */
+#define MAX_RANGES 16         /* More ranges than this and the Range header is ignored */
+#define RANGE_BOUNDARY "TINY_7f3a9c2e51b8d406"  /* multipart/byteranges separator */
+
+enum { ENGINE_ITER, ENGINE_THREAD, ENGINE_PREFORK };
+
+/* One client connection; buf outlives each request's arena */
+typedef struct {
+  int fd;
+  size_t len;         /* Bytes in buf */
+  size_t used;        /* Head of the request just served, dropped before the next read */
+  char buf[MAXBUF];   /* Request head + pipelined bytes that came after it */
+} conn_t;
+
+/* One satisfiable byte range of a Range header */
+typedef struct {
+  off_t start, end;   /* Inclusive */
+} range_t;
+
+void serve_forever(int listenfd, int use_sbuf);
+void *thread(void *vargp);
+int prefork(int *listenfds, int nprocs);
+int open_listener(char *port, int backlog, int flags);
+void serve(int fd, arena_t *arena);
+int doit(conn_t *c, arena_t *arena, int more);
+int read_requesthdrs(conn_t *c, http_request_t *req);
+int request_keepalive(http_request_t *req);
 int parse_uri(char *uri, char *filename, char *cgiargs);
-void serve_static(int fd, char *filename, int filesize, char *method);
+int serve_static(int fd, char *filename, struct stat *sbuf, char *method, int keepalive);
+int serve_cached(int fd, fcache_obj_t *obj, char *method, int keepalive);
+int parse_range(const char *spec, off_t size, range_t *ranges);
+int serve_ranges(int fd, char *filename, off_t filesize, fcache_obj_t *obj,
+                 range_t *ranges, int nranges, int keepalive);
+int range_part_head(char *buf, char *filetype, range_t *r, off_t filesize);
+ssize_t send_range(int fd, int srcfd, off_t offset, size_t count);
+int end_head(char *buf, int keepalive);
+void set_cork(int fd, int on);
 void get_filetype(char *filename, char *filetype);
-void serve_dynamic(int fd, char *filename, char *cgiargs, char *method);
+void serve_dynamic(int fd, char *filename, char *cgiargs, char *method, arena_t *arena);
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg,
-                 char *longmsg);
+                 char *longmsg, int keepalive);
+void sigusr1_handler(int sig);
+
+static volatile long nwakeups, naccepts; /* poll wakeups / connections accepted (SIGUSR1) */
+static sbuf_t sbuf; /* Connected descriptors for the worker threads (-e thread) */
+static int keepalive_max; /* Requests per connection before tiny closes it (-k) */
 
 //서버의 기능들은 모두 int main() 함수에 구현되어 있음.
 //argc => 커맨드 라인 인자의 개수, **argv => 커맨드 라인 인자들을 가리키는 포인터 배열
 
-//포트 번호를 인자로 받아 클라이언트 요청이 들어올 때마다 새로운 연결 소켓 만들어서 doit() 함수 호출
+//포트 번호를 인자로 받아 리스닝 소켓을 열고, 고른 엔진으로 연결을 처리한다
+// -e iter: 예전처럼 연결 하나를 끝까지 처리한 뒤 다음 연결을 accept (기본)
+// -e thread: 메인 스레드가 accept해서 sbuf에 넣고 워커 스레드 t개가 꺼내서 doit
+// -e prefork: 자식 프로세스 t개가 각자 accept + doit (반복 서버 t개)
+//느린 클라이언트나 CGI 하나가 붙잡는 것은 워커 하나뿐이고 나머지 방문자는 계속 처리된다
 int main(int argc, char **argv) {
-  int listenfd, connfd; 
+  int i, *listenfds, nlisten;
+  pthread_t tid;
+  int opt, backlog = LISTENQ, flags = 0;
+  int engine = ENGINE_ITER, nworkers = NWORKERS, nslots = SBUFSIZE, maxreq = 0;
+  size_t cachesize = FCACHE_SIZE;
+
+  /* Check command line args */
+  // ./tiny [-e iter|thread|prefork] [-t nworkers] [-q queuesize] [-k maxreqs] [-l backlog] [-r] [-d] [-f] [-c cachebytes] <port>
+  // -k: 연결 하나에서 처리할 최대 요청 수 (1이면 응답마다 연결을 닫음)
+  //     기본은 KEEPALIVE_MAX, -e iter만 1 - 반복 서버는 유휴 연결 하나가 서버 전체를 붙잡기 때문
+  // -r: SO_REUSEPORT 리스닝 소켓 -> 같은 포트에 tiny를 여러 개 띄우면 커널이 연결을 나눠 준다
+  //     -e prefork에서는 자식마다 자기 리스닝 소켓을 받는다 (자식끼리 accept를 다투지 않음)
+  //     대신 커널이 연결을 소켓에 해시로 나누므로 자식 하나가 막히면 그 소켓에 배정된 연결도 기다린다 -> -d와 같이
+  // -d: TCP_DEFER_ACCEPT -> 요청이 도착한 연결만 accept (연결만 맺고 가만히 있는 클라이언트에 tiny가 묶이지 않음)
+  // -f: TCP_FASTOPEN -> 다시 오는 클라이언트는 SYN에 요청을 실어 보낼 수 있다
+  // -c: 정적 파일 캐시의 바이트 한도 (0이면 캐시 끔, prefork에서는 자식마다 따로)
+  while ((opt = getopt(argc, argv, "e:t:q:k:l:rdfc:")) != -1) {
+    switch (opt) {
+    case 'e':
+      if (!strcmp(optarg, "iter"))
+        engine = ENGINE_ITER;
+      else if (!strcmp(optarg, "thread"))
+        engine = ENGINE_THREAD;
+      else if (!strcmp(optarg, "prefork"))
+        engine = ENGINE_PREFORK;
+      else
+        optind = argc;
+      break;
+    case 't':
+      nworkers = atoi(optarg);
+      break;
+    case 'q':
+      nslots = atoi(optarg);
+      break;
+    case 'k':
+      if ((maxreq = atoi(optarg)) <= 0)
+        optind = argc;
+      break;
+    case 'l':
+      backlog = atoi(optarg);
+      break;
+    case 'r':
+      flags |= LISTEN_REUSEPORT;
+      break;
+    case 'd':
+      flags |= LISTEN_DEFER_ACCEPT;
+      break;
+    case 'f':
+      flags |= LISTEN_FASTOPEN;
+      break;
+    case 'c':
+      cachesize = strtoul(optarg, NULL, 0);
+      break;
+    default:
+      optind = argc; /* usage 출력으로 */
+      break;
+    }
+  }
+  //포트 번호가 전달되지 않았으면 프로그램 사용 법 출력하고 프로그램 Exit
+  if (optind != argc - 1 || nworkers <= 0 || nslots <= 0) {
+    fprintf(stderr, "usage: %s [-e iter|thread|prefork] [-t nworkers] [-q queuesize] [-k maxreqs] [-l backlog] [-r] [-d] [-f] [-c cachebytes] <port>\n", argv[0]);
+    exit(1);
+  }
+
+  keepalive_max = maxreq ? maxreq : (engine == ENGINE_ITER ? 1 : KEEPALIVE_MAX);
+
+  //클라이언트가 응답 도중 연결을 끊어도 SIGPIPE로 서버가 죽지 않게 한다
+  //연결 하나에서 생긴 에러는 _e 래퍼로 출력만 하고 그 연결만 포기한다 (서버는 계속 동작)
+  Server_init();
+  Signal(SIGUSR1, sigusr1_handler); //kill -USR1 <pid> 로 accept, 파일 캐시 통계 출력 (prefork는 자식 pid로)
+  fcache_init(cachesize);
+  printf("HTTP head parser: %s\n", http_parse_impl()); //avx2 / sse2 / scalar 중 실제로 쓰는 구현
+
+  //prefork + -r이면 자식마다 자기 리스닝 소켓, 아니면 모두 같은 소켓 하나
+  nlisten = (engine == ENGINE_PREFORK && (flags & LISTEN_REUSEPORT)) ? nworkers : 1;
+  listenfds = Malloc(nlisten * sizeof(int));
+  for (i = 0; i < nlisten; i++)
+    listenfds[i] = open_listener(argv[optind], backlog, flags); //포트를 열어서 들어오는 연결 요청을 기다리는 리스닝 소켓 생성
+
+  if (engine == ENGINE_PREFORK) {
+    //부모는 자식을 관리만 하고 반환하지 않는다. 자식은 자기가 맡을 리스닝 소켓을 받아 아래 루프로
+    i = prefork(listenfds, nworkers);
+    serve_forever(listenfds[nlisten > 1 ? i : 0], 0);
+  }
+  if (engine == ENGINE_THREAD) {
+    //워커 스레드 풀 생성 -> 모두 sbuf에서 connfd가 들어오기를 기다림
+    sbuf_init(&sbuf, nslots);
+    for (i = 0; i < nworkers; i++)
+      Pthread_create(&tid, NULL, thread, NULL);
+  }
+  serve_forever(listenfds[0], engine == ENGINE_THREAD);
+}
+
+//open_listener - 논블로킹, CLOEXEC 리스닝 소켓
+//poll로 한 번 깨어나면 대기 중인 연결을 accept4로 EAGAIN이 날 때까지 모두 받는다
+//CGI 자식(execve)이 리스닝 소켓과 다른 연결 소켓을 물려받지 않도록 CLOEXEC
+int open_listener(char *port, int backlog, int flags) {
+  int listenfd = Open_listenfd_ex(port, backlog, flags);
+
+  fcntl(listenfd, F_SETFL, O_NONBLOCK);
+  fcntl(listenfd, F_SETFD, FD_CLOEXEC);
+  return listenfd;
+}
+
+//serve_forever - 리스닝 소켓에서 연결을 받아 처리 (반환하지 않음)
+//use_sbuf면 connfd를 워커 스레드에게 넘기고, 아니면 이 스레드에서 doit
+void serve_forever(int listenfd, int use_sbuf) {
+  int connfd;
+  struct pollfd pfd;
   //listenfd : client 연결 요청을 기다리는데 사용되는 소켓의 파일 디스크립터
   // connfd: 통신을 위한 소켓의 파일 디스크립터
   char hostname[MAXLINE], port[MAXLINE];
   socklen_t clientlen; //클라이언트 주소 구조체 크기 저장
   struct sockaddr_storage clientaddr; //클라이언트 주소 정보
+  arena_t arena; //요청마다 비우고 다시 쓰는 요청용 메모리 (요청 헤드, 파일 이름, CGI 인자)
 
-  /* Check command line args */
-  //.tiny 8000 처럼 argc 가 2개 입력되지 않았다면, 포트 번호가 전달되지 않은 것 -> 프로그램 사용 법 출력하고 프로그램 Exit
-  if (argc != 2) {
-    fprintf(stderr, "usage: %s <port>\n", argv[0]);
-    exit(1);
-  }
+  arena_init(&arena, ARENA_SIZE); //블록은 첫 할당 때 생긴다 (use_sbuf면 쓰지 않음)
+  pfd.fd = listenfd;
+  pfd.events = POLLIN;
 
-  listenfd = Open_listenfd(argv[1]); //argv[1] 포트를 열어서 들어오는 연결 요청을 기다리는 리스닝 소켓 생성                    
- 
   //무한 반복하여 클라이언트의 연결 요청 처리
   while (1) {
-    clientlen = sizeof(clientaddr); //클라이언트 주소 구조체의 크기 설정
-    //클라이언트의 연결 요청 수락, 통신을 위한 새로운 소켓 생성(connfd)
-    connfd = Accept(listenfd, (SA *)&clientaddr,
-                    &clientlen);  // line:netp:tiny:accept
-    //클라이언트 주소 정보를 문자열로 변환
-    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE,0);
-    printf("Accepted connection from (%s, %s)\n", hostname, port);
-    //클라이언트 통신 처리
-    doit(connfd);   // line:netp:tiny:doit 클라이언트와 통신
-    Close(connfd);  // line:netp:tiny:close 서버 연결 식별자 연결 종료
+    if (poll(&pfd, 1, -1) < 0)
+      continue; //SIGUSR1 등으로 EINTR
+    nwakeups++;
+    while (1) {
+      clientlen = sizeof(clientaddr); //클라이언트 주소 구조체의 크기 설정
+      //클라이언트의 연결 요청 수락, 통신을 위한 새로운 소켓 생성(connfd)
+      //연결 소켓은 블로킹 그대로 둔다 (doit이 블로킹 read/write를 함)
+      if ((connfd = accept4(listenfd, (SA *)&clientaddr, &clientlen,
+                            SOCK_CLOEXEC)) < 0) {  // line:netp:tiny:accept
+        if (errno == EINTR || errno == ECONNABORTED)
+          continue;
+        //EAGAIN: 대기 중인 연결을 다 받음 (prefork에서는 다른 자식이 먼저 가져간 경우도)
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+          unix_warning("Accept error"); //EMFILE 등 - 다음 wakeup에서 다시 시도
+        break;
+      }
+      naccepts++;
+      //클라이언트 주소 정보를 문자열로 변환
+      if (Getnameinfo_e((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0) != 0) {
+        strcpy(hostname, "?");
+        strcpy(port, "?");
+      }
+      printf("Accepted connection from (%s, %s)\n", hostname, port);
+      if (use_sbuf) {
+        sbuf_insert(&sbuf, connfd); //큐가 가득 차 있으면 빈 슬롯이 생길 때까지 블록
+        continue;
+      }
+      //클라이언트 통신 처리
+      serve(connfd, &arena);   // line:netp:tiny:doit 클라이언트와 통신
+      Close(connfd);  // line:netp:tiny:close 서버 연결 식별자 연결 종료
+    }
+  }
+}
+
+//워커 스레드 루틴 - sbuf에서 connfd를 하나씩 꺼내 요청을 처리하고 닫는다. arena는 워커마다 하나
+void *thread(void *vargp) {
+  arena_t arena;
+
+  Pthread_detach(pthread_self());
+  arena_init(&arena, ARENA_SIZE);
+  while (1) {
+    int connfd = sbuf_remove(&sbuf);
+    serve(connfd, &arena);
+    Close(connfd);
   }
+  return NULL;
 }
 
+//prefork - 자식 nprocs개를 만들고, 부모는 끝난 자식 자리에 새 자식을 띄우며 반환하지 않는다
+//자식에서는 자기 번호(0..nprocs-1)를 반환 -> 같은 번호의 자식은 같은 리스닝 소켓을 이어받는다
+int prefork(int *listenfds, int nprocs) {
+  pid_t pid, ppid = getpid(), *pids = Calloc(nprocs, sizeof(pid_t));
+  int i;
+
+  while (1) {
+    for (i = 0; i < nprocs; i++) {
+      if (pids[i] > 0)
+        continue;
+      fflush(stdout); //부모 버퍼에 남은 출력이 자식마다 다시 찍히지 않게
+      if ((pid = Fork()) == 0) {
+        //부모가 죽으면 자식도 끝낸다 (주인 없는 자식들이 포트를 계속 잡고 있지 않도록)
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != ppid)
+          exit(0);
+        Free(pids);
+        return i;
+      }
+      pids[i] = pid;
+    }
+    //자식 하나가 끝날 때까지 기다렸다가 그 자리를 다시 채운다
+    if ((pid = waitpid(-1, NULL, 0)) < 0)
+      continue;
+    for (i = 0; i < nprocs; i++)
+      if (pids[i] == pid)
+        pids[i] = 0;
+  }
+}
+
+//sigusr1_handler - poll wakeup 수와 accept한 연결 수 출력 (연결 수 / wakeup 수 = 한 번에 받은 평균 연결 수)
+void sigusr1_handler(int sig) {
+  int olderrno = errno;
+  sio_puts("accept: wakeups ");
+  sio_putl(nwakeups);
+  sio_puts(" accepts ");
+  sio_putl(naccepts);
+  sio_puts("\n");
+  fcache_print_stats();
+  errno = olderrno;
+}
+
+
+//serve - 한 클라이언트 연결에서 요청을 차례로 처리한다 (HTTP/1.1 persistent connection)
+//파이프라인으로 미리 도착한 다음 요청은 conn.buf에 남아 있다가 다음 doit이 이어서 읽으므로
+//응답은 항상 요청 순서대로 나간다. keepalive_max개를 처리했거나 doit이 0을 반환하면 끝
+void serve(int fd, arena_t *arena) {
+  struct timeval tv = {KEEPALIVE_TIMEOUT, 0};
+  int one = 1, nreq = 0;
+  conn_t conn;
+
+  conn.fd = fd;
+  conn.len = conn.used = 0;
+  if (keepalive_max > 1) {
+    //다음 요청을 KEEPALIVE_TIMEOUT초 넘게 기다리지 않는다 -> 유휴 연결이 워커를 계속 붙잡지 않게
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    //연결을 닫지 않으므로 Nagle 알고리즘이 다음 응답을 앞 응답의 ACK까지 붙잡지 않게 한다
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  while (doit(&conn, arena, ++nreq < keepalive_max))
+    ;
+}
 
 //doit() 함수 - 한개의 HTTP 트랜잭션 처리 -> Tiny는 GET 메소드만 지원
 //클라이언트로부터 요청을 받고 해당 요청이 static or dynamic 콘텐츠 요청하는지 판단한 후 요청에 맞는 콘텐츠 제공
 // -> connfd가 인자로 들어오게 됨
-void doit(int fd) {
+//연결을 유지하고 다음 요청을 읽어도 되면 1, 닫아야 하면 0 (more가 0이면 이번이 마지막 요청)
+int doit(conn_t *c, arena_t *arena, int more) {
+  int fd = c->fd;
   int is_static; //정적 콘텐츠인지 동적 컨텐츠인지 판별하는 변수
   struct stat sbuf; //파일의 상태 정보를 저장할 구조체
-  char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];// 클라이언트에게서 받은 요청(rio)로 채워지게 된다.
-  char filename[MAXLINE], cgiargs[MAXLINE]; // 파싱된 파일 이름과 CGI 인수를 저장할 배열들
-  rio_t rio; // Robust I/O 구조체
-
+  char *method, *uri; // c->buf 안의 메소드, URI를 가리킨다
+  char *filename, *cgiargs; // 파싱된 파일 이름과 CGI 인수 - URI 길이에 맞춰 arena에서 할당
+  http_request_t req; // 파싱된 요청 라인과 헤더 배열
+  fcache_obj_t *obj; // 캐시에 있는 정적 파일
+  range_t ranges[MAX_RANGES]; // Range 헤더에서 요청한 바이트 범위
+  const char *range = NULL; // Range 헤더 값 (GET에만 적용, 없으면 NULL)
+  int n, nranges, keepalive;
+
+  arena_reset(arena); //이전 요청에서 쓴 메모리를 한 번에 버린다
   /*Read request line and headers*/
-  /*request 라인과 헤더를 읽음*/
-  Rio_readinitb(&rio, fd); //RIO 버퍼 초기화 - rio 버퍼와 서버의 connfd를 연결시켜준다.
-  
-  if (!(Rio_readlineb(&rio, buf, MAXLINE))){
-    return;
+  /*request 라인과 헤더를 한 번에 읽어서 파싱 -> 메소드, URI, 버전, 헤더 추출*/
+  if ((n = read_requesthdrs(c, &req)) == 0)
+    return 0;
+  if (n < 0) {
+    clienterror(fd, "request", "400", "Bad Request",
+        "Tiny couldn't parse the request", 0);
+    return 0;
   }
-  printf("%s", buf);
-  sscanf(buf, "%s %s %s", method, uri, version); //request line 파싱 -> 메소드, URI, 버전 추출
+  method = req.method;
+  uri = req.uri;
+  keepalive = more && request_keepalive(&req);
+  if (strcasecmp(method, "GET") == 0)
+    range = http_header(&req, "Range");
   
   //strcasecmp(): 대소문자를 구분하지 않고 스트링 비교
   // 일치하면 0 return 
@@ -85,21 +349,39 @@ void doit(int fd) {
   // if (strcasecmp(method, "GET")) {
   if (!(strcasecmp(method, "GET") == 0 || strcasecmp(method, "HEAD") == 0)) {
     clienterror(fd, method, "501", "Not implemented",
-        "Tiny does not implement this method");
-        return;
+        "Tiny does not implement this method", 0);
+        return 0; //본문이 따라올 수 있는 메소드 -> 읽지 않았으므로 연결을 닫는다
   }
 
-  //Request header 읽음
-  read_requesthdrs(&rio);
+  //filename = "." + uri (+ "home.html") 이 MAXLINE 안에 들어가야 한다
+  if (req.uri_len + 16 > MAXLINE) {
+    clienterror(fd, "uri", "414", "URI Too Long",
+        "Tiny couldn't handle this URI", keepalive);
+    return keepalive;
+  }
 
   /*Parse URI from GET request, GET 요청에서 URI 파싱*/
+  filename = arena_alloc(arena, req.uri_len + 16); //"." + uri + "home.html"
+  cgiargs = arena_alloc(arena, req.uri_len + 1);
   is_static = parse_uri(uri, filename, cgiargs); //URI 파싱해서 정적/동적 콘텐츠 판별 - 정적(1), 동적(0)
+
+  //캐시에 있는 정적 파일이면 stat/open/read/close 없이 메모리에서 바로 응답
+  //Range 요청이면 캐시된 내용 중 그 범위만 잘라 보낸다 (Range가 잘못되었으면 무시하고 전체)
+  if (is_static && (obj = fcache_find(filename))) {
+    if ((nranges = parse_range(range, obj->size - obj->hdr_len, ranges)) != 0)
+      keepalive = serve_ranges(fd, filename, obj->size - obj->hdr_len, obj,
+                               ranges, nranges, keepalive);
+    else
+      keepalive = serve_cached(fd, obj, method, keepalive);
+    fcache_release(obj);
+    return keepalive;
+  }
   
   //파일 상태 정보를 가져오는데 실패한 경우 => 클라이언트에게 404 에러
   if (stat(filename, &sbuf) < 0) {
     clienterror(fd, filename, "404", "Not found",
-          "Tiny couldn't find this file");
-    return;
+          "Tiny couldn't find this file", keepalive);
+    return keepalive;
   }
 
   /*Serve static content, 정적 콘텐츠 제공*/
@@ -109,10 +391,13 @@ void doit(int fd) {
     //S_IRUSR :소유자의 읽기 권한, sbuf.st_mode : 권한 비트 -> 해당 권한이 설정되었는지 검사
     if (!(S_ISREG(sbuf.st_mode)) || !(S_IRUSR & sbuf.st_mode)) {
       clienterror(fd, filename, "403", "Forbidden",
-            "Tiny couldn't read the file");
-      return;
+            "Tiny couldn't read the file", keepalive);
+      return keepalive;
     }
-    serve_static(fd, filename, sbuf.st_size, method); //정적 콘텐츠 제공
+    //Range 요청이면 파일의 그 오프셋에서 바로 보낸다 -> 파일 전체를 읽거나 캐시에 올리지 않는다
+    if ((nranges = parse_range(range, sbuf.st_size, ranges)) != 0)
+      return serve_ranges(fd, filename, sbuf.st_size, NULL, ranges, nranges, keepalive);
+    return serve_static(fd, filename, &sbuf, method, keepalive); //정적 콘텐츠 제공
   }
   /*Serve dynamic content 동적 콘텐츠 제공*/
   else { 
@@ -120,55 +405,94 @@ void doit(int fd) {
     //S_IXUSR: 파일 소유자의 실행 권한
     if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) {
       clienterror(fd, filename, "403", "Forbidden",
-            "Tiny couldn't run the CGI program");
-      return;
+            "Tiny couldn't run the CGI program", keepalive);
+      return keepalive;
     }
-    serve_dynamic(fd, filename, cgiargs, method); //동적 콘텐츠 제공
+    serve_dynamic(fd, filename, cgiargs, method, arena); //동적 콘텐츠 제공
+    return 0; //CGI 출력은 길이를 모르므로 연결을 닫아서 끝을 알린다
   }
+}
+
+//request_keepalive - 요청이 연결 유지를 원하는지
+//HTTP/1.1은 기본이 keep-alive, HTTP/1.0은 "Connection: keep-alive"일 때만
+//요청 본문은 읽지 않으므로 본문이 있는 요청(Content-Length, Transfer-Encoding) 뒤에는 닫는다
+int request_keepalive(http_request_t *req) {
+  const char *conn = http_header(req, "Connection");
+  const char *clen = http_header(req, "Content-Length");
 
+  if (http_header(req, "Transfer-Encoding") || (clen && atol(clen) != 0))
+    return 0;
+  if (conn && !strcasecmp(conn, "close"))
+    return 0;
+  if (conn && !strcasecmp(conn, "keep-alive"))
+    return 1;
+  return !strcmp(req->version, "HTTP/1.1");
 }
 
 
 //클라이언트에게 에러 메시지 전송 -> HTML 형식의 에러 페이지를 구성하여 클라이언트에게 전송
 //sprintf() 함수: printf()와 유사하게 동작하지만 출력 결과를 화면에 표시하는 대신 지정된 문자 배열(buffer)에 저장
-void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg) {
+//keepalive면 응답 뒤에도 연결을 유지한다고 알린다 (본문 길이는 Content-length로)
+void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg, int keepalive) {
   char buf[MAXLINE], body[MAXBUF];
+  struct iovec iov[2];
+  int n, n2;
 
   /* Build the HTTP response body, HTTP 응답 본문*/
-  sprintf(body, "<html><title>Tiny Error</title>");
-  sprintf(body, "%s<body bgcolor=""ffffff"">\r\n", body);
-  sprintf(body, "%s%s: %s\r\n", body, errnum, shortmsg);
-  sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause); //긴 메시지와 원인
-  sprintf(body, "%s<hr><em>The Tiny Web server</em>\r\n", body); 
+  //버퍼 자신을 %s로 다시 넘기면 겹치는 복사가 되므로 지금까지 쓴 길이(n) 뒤에 이어 쓴다
+  n = sprintf(body, "<html><title>Tiny Error</title>");
+  n += sprintf(body + n, "<body bgcolor=""ffffff"">\r\n");
+  n += sprintf(body + n, "%s: %s\r\n", errnum, shortmsg);
+  n += snprintf(body + n, MAXBUF - n, "<p>%s: %s\r\n", longmsg, cause); //긴 메시지와 원인
+  if (n > MAXBUF - 64) //원인이 너무 길면 잘라냄
+    n = MAXBUF - 64;
+  n += sprintf(body + n, "<hr><em>The Tiny Web server</em>\r\n"); 
 
 
   /*Print the HTTP response*/
-  sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-  Rio_writen(fd, buf, strlen(buf)); //buf에 저장된 HTTP 헤더 정보를 fd를 통해 연결된 클라이언트에게 정확한 길이만큼 전송
-  sprintf(buf, "Content-type: text/html\r\n");
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-
-  //Rio_writen()으로 buf와 body를 서버 소켓(connfd)을 통해 클라이언트에게 전송
-  Rio_writen(fd, buf, strlen(buf));
-  Rio_writen(fd, body, strlen(body));
+  //응답 라인 + 헤더를 buf에 모아두고, buf와 body를 Rio_writev 한 번으로 전송 (write 4번 -> 1번)
+  iov[0].iov_base = buf;
+  n2 = sprintf(buf, "HTTP/1.1 %s %s\r\n"
+                    "Content-type: text/html\r\n"
+                    "Content-length: %d\r\n", errnum, shortmsg, n);
+  iov[0].iov_len = n2 + end_head(buf + n2, keepalive);
+  iov[1].iov_base = body;
+  iov[1].iov_len = n;
+  Rio_writev_e(fd, iov, 2);
 }
 
 
-//HTTP 요청 헤더를 읽고 출력만 하고 있음 - 헤더 내의 어떤 정보도 사용하고 있지 않음 그냥 읽고 무시
-//-> 요청의 본문을 처리하기 위해 헤더 부분을 넘어가기 위한 용도로만 현재 사용되고 있음
-void read_requesthdrs(rio_t *rp) {
-  char buf[MAXLINE];
+//요청 헤드(요청 라인 + 헤더 + 빈 줄) 전체가 buf에 들어올 때까지 읽고 httpparse.c로 한 번에 파싱
+//줄마다 Rio_readlineb + sscanf + strcmp 하던 것을 SIMD로 구분 문자를 찾는 파서 한 번으로 대신한다.
+//헤드 길이를 반환, 헤드 전에 연결이 끊기거나 KEEPALIVE_TIMEOUT이 지나면 0, 형식이 잘못되었거나 buf보다 크면 -1
+//헤드 뒤에 같이 도착한 바이트(파이프라인된 다음 요청)는 c->buf에 남겨 두었다가 다음 호출이 먼저 파싱한다
+int read_requesthdrs(conn_t *c, http_request_t *req) {
+  ssize_t n;
+  int rc, i;
 
-  Rio_readlineb(rp, buf, MAXLINE); //첫번째 헤더 라인 읽음
-  
-  //strcmp(): 두 문자열 비교 
-  //HTTP의 헤더 끝까지(루프를 통해 \r\n만 포함된 빈 줄을 만날 떄까지) 데이터 읽어옴
-  while(strcmp(buf, "\r\n")) {
-    Rio_readlineb(rp, buf, MAXLINE); // 다음 헤더 라인 한줄씩 읽고 
-    printf("%s", buf); //출력
+  //앞 요청의 헤드를 버리고 뒤에 남은 바이트를 버퍼 앞으로 당긴다
+  if (c->used) {
+    memmove(c->buf, c->buf + c->used, c->len - c->used);
+    c->len -= c->used;
+    c->used = 0;
+  }
+  while ((rc = c->len ? http_parse_request(c->buf, c->len, req) : 0) == 0) {
+    if (c->len == sizeof(c->buf)) //헤드가 버퍼보다 큼
+      return -1;
+    if ((n = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len)) < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return 0;
+    c->len += n;
   }
-  return;
+  if (rc < 0)
+    return -1;
+  c->used = rc;
+
+  printf("%s %s %s\n", req->method, req->uri, req->version);
+  for (i = 0; i < req->nheaders; i++)
+    printf("%s: %s\n", req->headers[i].name, req->headers[i].value); //출력
+  return rc;
 }
 
 
@@ -260,34 +584,266 @@ int parse_uri(char *uri, char *filename, char *cgiargs) {
 /// 파일의 메모리를 그대로 가상 메모리에 매핑하는 mmap()와 달리
 // 파일의 크기만큼 메모리를 동적 할당 해준 뒤, rio_readn() 사용해서 파일의 데이터를 메모리로 읽어와야 한다.
 
-void serve_static(int fd, char *filename, int filesize, char *method){
-  int srcfd;
+//연결을 유지해도 되면 1 (keepalive이고 본문을 Content-length만큼 다 보냈을 때)
+int serve_static(int fd, char *filename, struct stat *sbuf, char *method, int keepalive){
+  int srcfd, filesize = sbuf->st_size;
   char *srcp, filetype[MAXLINE], buf[MAXBUF];
+  struct iovec iov[3];
+  ssize_t rc;
+  int n, m;
 
-  /*Send response headers to client*/
+  /*Build response headers*/
+  //Connection 줄 앞까지(n 바이트)는 연결과 상관없으므로 캐시에 그대로 넣고, Connection 줄과 빈 줄은 응답마다 붙인다
   get_filetype(filename, filetype); //파일 이름을 바탕으로 파일의 MIME 타입 결정
-  sprintf(buf, "HTTP/1.0 200 OK\r\n"); // HTTP 응답 시작 
-  sprintf(buf, "%sServer: Tiny Web Server\r\n", buf); //서버 정보
-  sprintf(buf, "%sConnection: close\r\n", buf); //연결 닫음
-  sprintf(buf, "%sContent-length: %d\r\n", buf, filesize); //콘텐츠 길이
-  sprintf(buf, "%sContent-type: %s\r\n\r\n", buf, filetype); //콘텐츠 타입
-
-  /*connfd를 통해 clinetfd에게, 응답라인과 헤더를 클라이언트에게 보냄.*/
-  Rio_writen(fd, buf, strlen(buf)); 
+  n = sprintf(buf, "HTTP/1.1 200 OK\r\n"); // HTTP 응답 시작 
+  n += sprintf(buf + n, "Server: Tiny Web Server\r\n"); //서버 정보
+  n += sprintf(buf + n, "Accept-Ranges: bytes\r\n"); //Range 요청으로 일부만 받을 수 있음 (동영상 탐색 등)
+  n += sprintf(buf + n, "Content-length: %d\r\n", filesize); //콘텐츠 길이
+  n += snprintf(buf + n, MAXBUF - 64 - n, "Content-type: %s\r\n", filetype); //콘텐츠 타입
+  m = n + end_head(buf + n, keepalive); //연결 유지 여부
   printf("Response headers: \n");
   printf("%s", buf);
 
-  if (strcasecmp(method, "HEAD")==0) {
-    return;
+  iov[0].iov_base = buf;
+  iov[0].iov_len = m;
+  //HEAD 요청이면 헤더만 보낸다
+  if (strcasecmp(method, "HEAD")==0)
+    return Rio_writev_e(fd, iov, 1) < 0 ? 0 : keepalive;
+  /*Send response headers and body to client*/
+  //stat 이후에 파일이 지워졌을 수 있다 -> 서버를 끝내지 않고 이 요청만 404
+  if ((srcfd = open(filename, O_RDONLY, 0)) < 0) { //요청받은 파일을 읽기 전용 모드(O_RDONLY)로 열기 
+    clienterror(fd, filename, "404", "Not found",
+                "Tiny couldn't open this file", keepalive);
+    return keepalive;
+  }
+
+  //캐시할 만큼 작은 파일은 헤더 뒤에 이어서 읽어 두고 writev 한 번으로 보낸 뒤 캐시에 넣는다
+  //다음 요청부터는 doit에서 fcache_find로 바로 응답
+  if (fcache_cacheable(filesize)) {
+    srcp = Malloc(n + filesize);
+    memcpy(srcp, buf, n);
+    if (Rio_readn_e(srcfd, srcp + n, filesize) == filesize) {
+      Close(srcfd);
+      iov[0].iov_base = srcp;
+      iov[0].iov_len = n;
+      iov[1].iov_base = buf + n;
+      iov[1].iov_len = m - n;
+      iov[2].iov_base = srcp + n;
+      iov[2].iov_len = filesize;
+      if (Rio_writev_e(fd, iov, 3) < 0)
+        keepalive = 0;
+      //stat(doit)과 read 사이에 파일이 바뀌었으면 기록한 mtime이 달라서 다음 확인 때 다시 읽힌다
+      if (!fcache_insert(filename, sbuf, srcp, n, n + filesize))
+        free(srcp);
+      return keepalive;
+    }
+    //그 사이 파일이 줄었다 -> 캐시하지 않고 아래 sendfile 경로로
+    free(srcp);
+  }
+
+  //본문은 sendfile로: 파일 페이지가 커널 안에서 바로 소켓으로 가므로 malloc도, 사용자 버퍼로의 복사도 없다
+  //TCP_CORK로 헤더를 붙잡아 두었다가 본문 앞부분과 같은 패킷으로 내보낸다 (헤더만 든 패킷이 따로 나가지 않게)
+  set_cork(fd, 1);
+  if (Rio_writen_e(fd, buf, m) < 0) {
+    Close(srcfd);
+    return 0;
   }
-  /*Send response body to client*/
-  srcfd = Open(filename, O_RDONLY, 0); //요청받은 파일을 읽기 전용 모드(O_RDONLY)로 열기 
-    
-  srcp = (char *)Malloc(filesize); //파일 크기만큼 메모리를 동적 할당
-  Rio_readn(srcfd, srcp, filesize); //파일 내용을 읽어서 동적할당한 메모리에 값을 저장.
+  rc = send_range(fd, srcfd, 0, filesize);
+  set_cork(fd, 0); //남은 바이트를 바로 내보낸다
   Close(srcfd);  //파일 닫음
-  Rio_writen(fd, srcp, filesize);  //해당 메모리에 있는 파일 내용들을 클라이언트에 보낸다.
-  free(srcp); //메모리 해제
+  //본문이 Content-length보다 짧게 나갔으면 연결을 닫아야 클라이언트가 응답 끝을 안다
+  return rc == filesize ? keepalive : 0;
+}
+
+//serve_cached - 캐시된 응답 헤드(+ 본문)에 이번 연결의 Connection 줄을 끼워 writev 한 번으로 보낸다
+//연결을 유지해도 되면 1 반환
+int serve_cached(int fd, fcache_obj_t *obj, char *method, int keepalive) {
+  char conn[32];
+  struct iovec iov[3];
+
+  iov[0].iov_base = obj->data;
+  iov[0].iov_len = obj->hdr_len;
+  iov[1].iov_base = conn;
+  iov[1].iov_len = end_head(conn, keepalive);
+  iov[2].iov_base = obj->data + obj->hdr_len;
+  iov[2].iov_len = obj->size - obj->hdr_len;
+  printf("Response headers: \n");
+  printf("%.*s%s", (int)obj->hdr_len, obj->data, conn);
+  //HEAD 요청이면 헤더만 보낸다
+  if (Rio_writev_e(fd, iov, strcasecmp(method, "HEAD") == 0 ? 2 : 3) < 0)
+    return 0;
+  return keepalive;
+}
+
+//parse_range - "bytes=0-499, 1000-, -500" 형식의 Range 헤더를 (끝을 포함하는) 범위들로 바꾼다
+//범위 개수, Range가 없거나 형식이 잘못되었거나 범위가 MAX_RANGES개보다 많으면 0 (헤더를 무시하고 전체 응답),
+//범위가 모두 파일 밖이면 -1 (416). 끝이 파일 크기를 넘는 범위는 파일 끝까지로 줄인다
+int parse_range(const char *spec, off_t size, range_t *ranges) {
+  char *p, *end;
+  long long a, b;
+  int n = 0;
+
+  if (!spec || strncasecmp(spec, "bytes=", 6))
+    return 0;
+  for (p = (char *)spec + 6; ; p++) {
+    while (*p == ' ' || *p == '\t')
+      p++;
+    if (*p == '-' && isdigit((unsigned char)p[1])) { //마지막 b바이트
+      b = strtoll(p + 1, &end, 10);
+      a = size - b < 0 ? 0 : size - b;
+      b = size - 1;
+    }
+    else if (isdigit((unsigned char)*p)) { //a-b 또는 a- (파일 끝까지)
+      a = strtoll(p, &end, 10);
+      if (*end != '-')
+        return 0;
+      if (isdigit((unsigned char)end[1])) {
+        b = strtoll(end + 1, &end, 10);
+        if (b < a)
+          return 0;
+      }
+      else {
+        b = size - 1;
+        end++;
+      }
+      if (b >= size)
+        b = size - 1;
+    }
+    else
+      return 0;
+    if (a <= b && a < size) { //파일 밖의 범위(빈 파일, 시작이 끝 뒤)는 건너뛴다
+      if (n == MAX_RANGES)
+        return 0;
+      ranges[n].start = a;
+      ranges[n++].end = b;
+    }
+    for (p = end; *p == ' ' || *p == '\t'; p++)
+      ;
+    if (*p == '\0')
+      break;
+    if (*p != ',')
+      return 0;
+  }
+  return n ? n : -1;
+}
+
+//serve_ranges - Range 요청에 206 Partial Content로 응답 (nranges가 -1이면 416)
+//범위 하나는 본문 그대로, 여러 개는 multipart/byteranges로 범위마다 작은 헤드를 붙여 보낸다
+//본문은 캐시된 객체(obj)가 있으면 메모리에서, 없으면 파일의 그 오프셋에서 sendfile로 -> 파일 전체를 읽지 않는다
+//연결을 유지해도 되면 1 반환
+int serve_ranges(int fd, char *filename, off_t filesize, fcache_obj_t *obj,
+                 range_t *ranges, int nranges, int keepalive) {
+  char filetype[MAXLINE], buf[MAXBUF], part[MAXLINE];
+  long long len = 0;
+  ssize_t rc = 0;
+  int srcfd = -1, n, i;
+
+  if (nranges < 0) {
+    n = sprintf(buf, "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                     "Server: Tiny Web Server\r\n"
+                     "Accept-Ranges: bytes\r\n"
+                     "Content-Range: bytes */%lld\r\n"
+                     "Content-length: 0\r\n", (long long)filesize);
+    n += end_head(buf + n, keepalive);
+    printf("Response headers: \n");
+    printf("%s", buf);
+    return Rio_writen_e(fd, buf, n) < 0 ? 0 : keepalive;
+  }
+
+  //파일이 그 사이 지워졌으면 헤드를 보내기 전에 404
+  if (!obj && (srcfd = open(filename, O_RDONLY, 0)) < 0) {
+    clienterror(fd, filename, "404", "Not found",
+                "Tiny couldn't open this file", keepalive);
+    return keepalive;
+  }
+
+  /*Build response headers*/
+  get_filetype(filename, filetype);
+  n = sprintf(buf, "HTTP/1.1 206 Partial Content\r\n"
+                   "Server: Tiny Web Server\r\n"
+                   "Accept-Ranges: bytes\r\n");
+  if (nranges == 1) {
+    len = ranges[0].end - ranges[0].start + 1;
+    n += sprintf(buf + n, "Content-Range: bytes %lld-%lld/%lld\r\n",
+                 (long long)ranges[0].start, (long long)ranges[0].end, (long long)filesize);
+    n += snprintf(buf + n, MAXBUF - 128 - n, "Content-type: %s\r\n", filetype);
+  }
+  else {
+    //본문 길이 = 범위마다 (구분 줄 + 범위 헤드 + 데이터) + 마지막 구분 줄
+    for (i = 0; i < nranges; i++)
+      len += range_part_head(part, filetype, &ranges[i], filesize) +
+             ranges[i].end - ranges[i].start + 1;
+    len += strlen("\r\n--" RANGE_BOUNDARY "--\r\n");
+    n += sprintf(buf + n, "Content-type: multipart/byteranges; boundary=" RANGE_BOUNDARY "\r\n");
+  }
+  n += sprintf(buf + n, "Content-length: %lld\r\n", len);
+  n += end_head(buf + n, keepalive);
+  printf("Response headers: \n");
+  printf("%s", buf);
+
+  //헤드, 범위 헤드, 데이터를 따로 쓰므로 TCP_CORK로 모아서 꽉 찬 세그먼트로 내보낸다
+  set_cork(fd, 1);
+  if (Rio_writen_e(fd, buf, n) < 0)
+    rc = -1;
+  for (i = 0; i < nranges && rc >= 0; i++) {
+    len = ranges[i].end - ranges[i].start + 1;
+    if (nranges > 1 &&
+        Rio_writen_e(fd, part, range_part_head(part, filetype, &ranges[i], filesize)) < 0)
+      rc = -1;
+    else if (obj)
+      rc = Rio_writen_e(fd, obj->data + obj->hdr_len + ranges[i].start, len);
+    else if ((rc = send_range(fd, srcfd, ranges[i].start, len)) != len)
+      rc = -1; //그 사이 파일이 줄었다 -> Content-length를 채울 수 없으니 연결을 닫는다
+  }
+  if (nranges > 1 && rc >= 0)
+    rc = Rio_writen_e(fd, "\r\n--" RANGE_BOUNDARY "--\r\n", strlen("\r\n--" RANGE_BOUNDARY "--\r\n"));
+  set_cork(fd, 0);
+  if (srcfd >= 0)
+    Close(srcfd);
+  return rc < 0 ? 0 : keepalive;
+}
+
+//range_part_head - multipart/byteranges에서 범위 하나 앞에 붙는 구분 줄과 헤드를 buf에 쓰고 길이를 반환
+int range_part_head(char *buf, char *filetype, range_t *r, off_t filesize) {
+  return snprintf(buf, MAXLINE, "\r\n--" RANGE_BOUNDARY "\r\n"
+                                "Content-type: %s\r\n"
+                                "Content-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                  filetype, (long long)r->start, (long long)r->end, (long long)filesize);
+}
+
+//send_range - 파일 srcfd의 offset부터 count 바이트를 fd로 보낸다. 보낸 바이트 수 (파일이 짧으면 count보다 작음), 에러면 -1
+//sendfile로 커널 안에서 바로 보내고, sendfile을 못 쓰는 파일이면(procfs 등) MAXBUF씩 읽어서 보낸다
+ssize_t send_range(int fd, int srcfd, off_t offset, size_t count) {
+  char buf[MAXBUF];
+  size_t nleft = count;
+  ssize_t rc;
+
+  if ((rc = rio_sendfile(fd, srcfd, &offset, count)) >= 0 || (errno != EINVAL && errno != ENOSYS)) {
+    if (rc < 0)
+      unix_warning("sendfile error"); //클라이언트가 끊은 경우 등 - 이 연결만 포기
+    return rc;
+  }
+  while (nleft > 0) {
+    if ((rc = pread(srcfd, buf, nleft < MAXBUF ? nleft : MAXBUF, offset)) < 0 && errno == EINTR)
+      continue;
+    if (rc <= 0)
+      break; //에러 또는 EOF
+    if (Rio_writen_e(fd, buf, rc) < 0)
+      return -1;
+    offset += rc;
+    nleft -= rc;
+  }
+  return rc < 0 ? -1 : count - nleft;
+}
+
+//end_head - 응답 헤드를 끝맺는 Connection 줄과 빈 줄을 buf에 쓰고 길이를 반환 (최대 28바이트)
+int end_head(char *buf, int keepalive) {
+  return sprintf(buf, "Connection: %s\r\n\r\n", keepalive ? "keep-alive" : "close");
+}
+
+//set_cork - TCP_CORK를 켜면 끌 때까지 꽉 차지 않은 세그먼트를 보내지 않는다 (TCP 소켓이 아니면 아무 일도 없음)
+void set_cork(int fd, int on) {
+  setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
 }
 
 
@@ -297,40 +853,51 @@ void serve_static(int fd, char *filename, int filesize, char *method){
 // serve_dynamic
 //동적 콘텐츠을 처리하기 위해 웹 서버에서 사용되는 함수
 //CGI 프로그램을 실행하고 그 출력을 클라이언트에게 직접 전송
-void serve_dynamic(int fd, char *filename, char *cgiargs, char* method) {
-  char buf[MAXLINE], *emptylist[] = {NULL};
+void serve_dynamic(int fd, char *filename, char *cgiargs, char* method, arena_t *arena) {
+  char buf[MAXLINE], *emptylist[] = {NULL}, **envp;
+  pid_t pid;
+  int i, n;
 
   /*Return first part of HTTP response*/
   //HTTP 응답의 첫 부분을 클라이언트에게 반환 -> 200: 요청이 성공적으로 처리되었음
-  sprintf(buf, "HTTP/1.0 200 OK\r\n");
-  Rio_writen(fd, buf, strlen(buf));
-
-  //서버 정보를 클라이언트에게 보냄
-  sprintf(buf, "Server: Tiny Web Server\r\n");
-  Rio_writen(fd, buf, strlen(buf));
-
-
+  //서버 정보까지 한 버퍼에 담아서 write 한 번으로 보냄
+  //CGI 출력의 끝은 연결을 닫아서 알리므로 이 연결은 유지하지 않는다
+  sprintf(buf, "HTTP/1.1 200 OK\r\n"
+               "Server: Tiny Web Server\r\n"
+               "Connection: close\r\n");
+  if (Rio_writen_e(fd, buf, strlen(buf)) < 0)
+    return; //클라이언트가 이미 끊었으면 CGI 프로그램을 실행하지 않는다
+
+  /*Real server would set all CGI vars here*/ 
+  //CGI 프로그램에 넘길 환경 = 서버의 환경 + QUERY_STRING(cgiargs) + REQUEST_METHOD
+  //자식에서 setenv를 하지 않고 부모에서 arena에 만들어 둔다 -> 스레드 모드에서 fork한 자식이
+  //다른 스레드가 잡고 있던 malloc 락에 걸리지 않게, 자식은 Dup2와 Execve만 한다
+  for (n = 0; environ[n]; n++)
+    ;
+  envp = arena_alloc(arena, (n + 3) * sizeof(char *));
+  envp[0] = arena_alloc(arena, strlen(cgiargs) + sizeof("QUERY_STRING="));
+  sprintf(envp[0], "QUERY_STRING=%s", cgiargs);
+  envp[1] = arena_alloc(arena, strlen(method) + sizeof("REQUEST_METHOD="));
+  sprintf(envp[1], "REQUEST_METHOD=%s", method);
+  for (i = 0, n = 2; environ[i]; i++)
+    if (strncmp(environ[i], "QUERY_STRING=", 13) && strncmp(environ[i], "REQUEST_METHOD=", 15))
+      envp[n++] = environ[i];
+  envp[n] = NULL;
 
   /*Child*/
   //자식 프로세스에서 실행되는 코드
-  if (Fork() == 0) {
-    /*Real server would set all CGI vars here*/ 
-    //CGI 프로그램에 전달될 QUERY_STRING 환경 변수 -> cgiargs로 설정
-    setenv("QUERY_STRING", cgiargs, 1);
-
-    //요청 메소드를 환경 변수에 추가
-    setenv("REQUEST_METHOD", method, 1);
-
+  if ((pid = Fork()) == 0) {
     Dup2(fd, STDOUT_FILENO); /*Redirect stdout to client, 
     CGI 프로세스의 표준 출력을 connfd에 복사 -> CGI 프로세스에서 표준 출력 하면 서버 연결 식별자를 거쳐 클라이언트에 출력됨*/
 
-    Execve(filename, emptylist, environ); /*Run CGI program* CGI 프로그램 실행 */
+    Execve(filename, emptylist, envp); /*Run CGI program* CGI 프로그램 실행 */
     //filename 변수에는 실행할 CGI 프로그램의 경로가 저장되어 있음. 
     //emptylist는 CGI 프로그램으로 전달될 인자 목록, 여기서는 인자 없이 실행됨
   }
   /*Parent waits for and reaps child 
   부모는 자식 프로세스가 종료될 때까지 기다림, 자식 프로세스가 종료되면 시스템 자원 회수*/
-  Wait(NULL); 
+  //Wait(NULL)은 다른 워커 스레드가 띄운 CGI 자식을 거둘 수 있다 -> 자기 자식만 기다린다
+  Waitpid(pid, NULL, 0); 
 }
 
 //Fork() : 현재 실행중인 프로세스(부모 프로세스)의 정확한 복사본 생성 - 자식 프로세스 생성
@@ -381,4 +948,4 @@ void get_filetype(char *filename, char *filetype) {
   //으로 "text/plain"으로 설정
   else 
     strcpy(filetype, "text/plain");
-}
\ No newline at end of file
+}